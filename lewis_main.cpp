@@ -22,6 +22,28 @@ PLEASE FILL OUT THIS SECTION PRIOR TO SUBMISSION
 #include <fstream>
 #include <cmath>
 #include <string> 
+#include <chrono>
+#include <algorithm>
+#include <cstdint>
+#include <climits>
+#include <cstdio>
+#include <sstream>
+#include <thread>
+#include <atomic>
+#include <memory>
+#include <cstring>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <cerrno>
+#include <new>
 using namespace std;
 
 //***************************************************************************************************//
@@ -269,485 +291,4315 @@ string validate_file_name(string input_file_name)
     }
 
 
+/** Helper function - write the BMP and DIB headers, and a gray palette
+ * for 8-bit images, leaving the stream at the start of the pixel array
+ * @param - open output stream
+ * @param - width in pixels
+ * @param - height in pixels
+ * @param - bits per pixel
+ * @param - number of gray palette entries (0 for no palette)
+ * @return - bytes per row including padding, or -1 (and nothing written)
+ *           if the image does not fit the 32-bit size fields of a BMP file
+*/
+
+int write_bmp_header(fstream& stream, long long width_pixels, long long height_pixels, int bits_per_pixel, int palette_colors)
+{
+    const int BMP_HEADER_SIZE = 14;
+    const int DIB_HEADER_SIZE = 40;
+    unsigned char bmp_header[BMP_HEADER_SIZE] = {0};
+    unsigned char dib_header[DIB_HEADER_SIZE] = {0};
+    int array_offset = BMP_HEADER_SIZE + DIB_HEADER_SIZE + palette_colors * 4;
+
+    // Calculate the width in bytes incorporating padding (4 byte alignment)
+    if (width_pixels > INT_MAX || height_pixels > INT_MAX) { return -1; }
+    long long width_bytes = width_pixels * (bits_per_pixel / 8);
+    width_bytes = width_bytes + (4 - width_bytes % 4) % 4;
+    long long array_bytes = width_bytes * height_pixels;
+    if (width_bytes > INT_MAX || array_offset + array_bytes > UINT32_MAX) { return -1; }
+
+    set_bytes(bmp_header,  0, 1, 'B');
+    set_bytes(bmp_header,  1, 1, 'M');
+    set_bytes(bmp_header,  2, 4, (uint32_t)(array_offset + array_bytes));
+    set_bytes(bmp_header, 10, 4, array_offset);
+
+    set_bytes(dib_header,  0, 4, DIB_HEADER_SIZE);
+    set_bytes(dib_header,  4, 4, width_pixels);
+    set_bytes(dib_header,  8, 4, height_pixels);
+    set_bytes(dib_header, 12, 2, 1);
+    set_bytes(dib_header, 14, 2, bits_per_pixel);
+    set_bytes(dib_header, 20, 4, (uint32_t)array_bytes);
+    set_bytes(dib_header, 24, 4, 2835);
+    set_bytes(dib_header, 28, 4, 2835);
+    set_bytes(dib_header, 32, 4, palette_colors);
+
+    stream.write((char*)bmp_header, sizeof(bmp_header));
+    stream.write((char*)dib_header, sizeof(dib_header));
+
+    // Gray palette for 8-bit images
+    for (int k = 0; k < palette_colors; k++)
+    {
+        unsigned char entry[4] = { (unsigned char)k, (unsigned char)k, (unsigned char)k, 0 };
+        stream.write((char*)entry, 4);
+    }
+    return (int)width_bytes;
+}
+
+/** Helper function - split rows into one band per thread
+ * @param - thread number
+ * @param - number of threads
+ * @param - number of rows
+ * @param - first row of the band (output)
+ * @param - one past the last row of the band (output)
+*/
+
+void row_band(int thread_number, int num_threads, int num_rows, int& first_row, int& end_row)
+{
+    first_row = (long)num_rows * thread_number / num_threads;
+    end_row = (long)num_rows * (thread_number + 1) / num_threads;
+}
+
+/** Helper function - run work(thread_number) on num_threads threads
+ * Thread t is pinned to CPU t (mod the number of CPUs). Memory is placed
+ * on the NUMA node of the thread that first touches it, so callers that
+ * allocate each band of rows inside work (allocate_band, read_image_banded)
+ * keep that band local to the thread that processes it in later passes
+ * with the same number of threads. A single band runs on the calling
+ * thread, unpinned.
+ * @param - number of threads
+ * @param - work to run
+*/
+
+template <typename F>
+void run_in_parallel(int num_threads, F work)
+{
+    if (num_threads <= 1)
+    {
+        work(0);
+        return;
+    }
+    int num_cpus = max(1u, thread::hardware_concurrency());
+    vector<thread> threads;
+    for (int t = 0; t < num_threads; t++)
+    {
+        threads.push_back(thread([t, num_cpus, &work]()
+        {
+            cpu_set_t cpus;
+            CPU_ZERO(&cpus);
+            CPU_SET(t % num_cpus, &cpus);
+            pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+            work(t);
+        }));
+    }
+    for (thread& worker : threads) { worker.join(); }
+}
+
+/** Helper function - size rows [first_row, end_row) of an image
+ * Call it from the worker thread that fills the band, so the rows are
+ * first touched on that thread's NUMA node rather than the caller's.
+ * @param - image with num_rows empty rows
+ * @param - first row of the band
+ * @param - one past the last row of the band
+ * @param - number of columns
+*/
+
+template <typename P>
+void allocate_band(vector<vector<P>>& image, int first_row, int end_row, int num_cols)
+{
+    for (int i = first_row; i < end_row; i++) { image[i].assign(num_cols, P()); }
+}
+
+/** Helper function - build an image one band of rows per thread
+ * Each thread sizes and fills its own rows, so they are first touched on
+ * its NUMA node (see allocate_band).
+ * @param - number of rows
+ * @param - number of columns
+ * @param - pixel(i, j), the output pixel at row i, column j
+ * @param - number of threads
+ * @return - the new image
+*/
+
+template <typename P, typename F>
+vector<vector<P>> build_image_banded(int num_rows, int num_cols, F pixel, int num_threads)
+{
+    vector<vector<P>> new_image(num_rows);
+    run_in_parallel(num_threads, [&](int t)
+    {
+        int first_row, end_row;
+        row_band(t, num_threads, num_rows, first_row, end_row);
+        allocate_band(new_image, first_row, end_row, num_cols);
+        for (int i = first_row; i < end_row; i++)
+        {
+            for (int j = 0; j < num_cols; j++) { new_image[i][j] = pixel(i, j); }
+        }
+    });
+    return new_image;
+}
+
+//
+// PIXEL FORMATS
+//
+// The Pixel struct stores every channel as an int, three per pixel. The
+// formats below describe the actual layout of the data, so read, write and
+// the filters can be compiled for each layout. Gray results stay a single
+// channel, alpha from 32-bit files is kept, and 16-bit channels keep their
+// precision. All per-format decisions are made at compile time through
+// Pixel_Format<P>, so the inner loops never branch on the format. Pixel has
+// traits too, so the views and writers below work on it unchanged.
+//
+
+struct Gray8 { uint8_t value; };
+struct Gray16 { uint16_t value; };
+struct BGR24 { uint8_t blue, green, red; };
+struct BGRA32 { uint8_t blue, green, red, alpha; };
+struct BGR48 { uint16_t blue, green, red; };
+
+/** Format traits - one specialization per pixel format
+ * depth           - bits per channel (8 or 16)
+ * max_value       - largest channel value
+ * bits_per_pixel  - how the format is stored in a BMP file
+ * gray_type       - single channel format of the same depth
+ * color_type      - three channel format of the same depth (for colored output)
+ * from_bgra       - build a pixel from channel values at this depth
+ * to_bgra         - split a pixel into channel values at this depth
+ * color_sum       - sum of the color channels (3x the value for gray)
+ * map_color       - apply f to each color channel (alpha is untouched)
+*/
+template <typename P> struct Pixel_Format;
+
+template <> struct Pixel_Format<Pixel>
+{
+    typedef Gray8 gray_type;
+    typedef Pixel color_type;
+    static const int depth = 8;
+    static const int max_value = 255;
+    static const int bits_per_pixel = 24;
+    static Pixel from_bgra(int blue, int green, int red, int) { return { red, green, blue }; }
+    static void to_bgra(const Pixel& p, int& blue, int& green, int& red, int& alpha) { blue = p.blue; green = p.green; red = p.red; alpha = max_value; }
+    static int color_sum(const Pixel& p) { return p.blue + p.green + p.red; }
+    template <typename F> static Pixel map_color(const Pixel& p, F f) { return { (int)f(p.red), (int)f(p.green), (int)f(p.blue) }; }
+};
+
+template <> struct Pixel_Format<Gray8>
+{
+    typedef Gray8 gray_type;
+    typedef BGR24 color_type;
+    static const int depth = 8;
+    static const int max_value = 255;
+    static const int bits_per_pixel = 8;    // with a gray palette
+    static Gray8 from_bgra(int blue, int green, int red, int) { return { (uint8_t)((blue + green + red) / 3) }; }
+    static void to_bgra(const Gray8& p, int& blue, int& green, int& red, int& alpha) { blue = green = red = p.value; alpha = max_value; }
+    static int color_sum(const Gray8& p) { return 3 * p.value; }
+    static Gray8 make_gray(int value) { return { (uint8_t)value }; }
+    template <typename F> static Gray8 map_color(const Gray8& p, F f) { return { (uint8_t)f(p.value) }; }
+};
+
+template <> struct Pixel_Format<Gray16>
+{
+    typedef Gray16 gray_type;
+    typedef BGR48 color_type;
+    static const int depth = 16;
+    static const int max_value = 65535;
+    static const int bits_per_pixel = 48;   // no 16-bit gray BMP, stored as BGR48
+    static Gray16 from_bgra(int blue, int green, int red, int) { return { (uint16_t)((blue + green + red) / 3) }; }
+    static void to_bgra(const Gray16& p, int& blue, int& green, int& red, int& alpha) { blue = green = red = p.value; alpha = max_value; }
+    static int color_sum(const Gray16& p) { return 3 * p.value; }
+    static Gray16 make_gray(int value) { return { (uint16_t)value }; }
+    template <typename F> static Gray16 map_color(const Gray16& p, F f) { return { (uint16_t)f(p.value) }; }
+};
+
+template <> struct Pixel_Format<BGR24>
+{
+    typedef Gray8 gray_type;
+    typedef BGR24 color_type;
+    static const int depth = 8;
+    static const int max_value = 255;
+    static const int bits_per_pixel = 24;
+    static BGR24 from_bgra(int blue, int green, int red, int) { return { (uint8_t)blue, (uint8_t)green, (uint8_t)red }; }
+    static void to_bgra(const BGR24& p, int& blue, int& green, int& red, int& alpha) { blue = p.blue; green = p.green; red = p.red; alpha = max_value; }
+    static int color_sum(const BGR24& p) { return p.blue + p.green + p.red; }
+    template <typename F> static BGR24 map_color(const BGR24& p, F f) { return { (uint8_t)f(p.blue), (uint8_t)f(p.green), (uint8_t)f(p.red) }; }
+};
+
+template <> struct Pixel_Format<BGRA32>
+{
+    typedef Gray8 gray_type;
+    typedef BGRA32 color_type;
+    static const int depth = 8;
+    static const int max_value = 255;
+    static const int bits_per_pixel = 32;
+    static BGRA32 from_bgra(int blue, int green, int red, int alpha) { return { (uint8_t)blue, (uint8_t)green, (uint8_t)red, (uint8_t)alpha }; }
+    static void to_bgra(const BGRA32& p, int& blue, int& green, int& red, int& alpha) { blue = p.blue; green = p.green; red = p.red; alpha = p.alpha; }
+    static int color_sum(const BGRA32& p) { return p.blue + p.green + p.red; }
+    template <typename F> static BGRA32 map_color(const BGRA32& p, F f) { return { (uint8_t)f(p.blue), (uint8_t)f(p.green), (uint8_t)f(p.red), p.alpha }; }
+};
+
+template <> struct Pixel_Format<BGR48>
+{
+    typedef Gray16 gray_type;
+    typedef BGR48 color_type;
+    static const int depth = 16;
+    static const int max_value = 65535;
+    static const int bits_per_pixel = 48;   // not a standard BMP layout, see read_image_as
+    static BGR48 from_bgra(int blue, int green, int red, int) { return { (uint16_t)blue, (uint16_t)green, (uint16_t)red }; }
+    static void to_bgra(const BGR48& p, int& blue, int& green, int& red, int& alpha) { blue = p.blue; green = p.green; red = p.red; alpha = max_value; }
+    static int color_sum(const BGR48& p) { return p.blue + p.green + p.red; }
+    template <typename F> static BGR48 map_color(const BGR48& p, F f) { return { (uint16_t)f(p.blue), (uint16_t)f(p.green), (uint16_t)f(p.red) }; }
+};
+
+/** Helper function - convert a channel value between 8 and 16 bit depth
+ * @param - channel value at depth From
+ * @return - channel value at depth To
+*/
+template <int From, int To> inline int convert_depth(int value)
+{
+    if (From == To) { return value; }
+    if (From == 8) { return value * 257; }      // 255 -> 65535
+    return (value + 128) / 257;                 // 65535 -> 255
+}
+
+/** BMP storage layouts read by read_image_as, one per bits per pixel
+ * read() gets the blue, green, red, alpha values of one stored pixel
+*/
+template <int BPP> struct Bmp_Layout;
+
+template <> struct Bmp_Layout<8>
+{
+    static const int depth = 8;
+    static void read(const unsigned char* bytes, const vector<BGRA32>& palette, int& blue, int& green, int& red, int& alpha)
+    {
+        const BGRA32& entry = palette[bytes[0]];
+        blue = entry.blue; green = entry.green; red = entry.red; alpha = 255;
+    }
+};
+
+template <> struct Bmp_Layout<24>
+{
+    static const int depth = 8;
+    static void read(const unsigned char* bytes, const vector<BGRA32>&, int& blue, int& green, int& red, int& alpha)
+    {
+        blue = bytes[0]; green = bytes[1]; red = bytes[2]; alpha = 255;
+    }
+};
+
+template <> struct Bmp_Layout<32>
+{
+    static const int depth = 8;
+    static void read(const unsigned char* bytes, const vector<BGRA32>&, int& blue, int& green, int& red, int& alpha)
+    {
+        blue = bytes[0]; green = bytes[1]; red = bytes[2]; alpha = bytes[3];
+    }
+};
+
+template <> struct Bmp_Layout<48>
+{
+    static const int depth = 16;
+    static void read(const unsigned char* bytes, const vector<BGRA32>&, int& blue, int& green, int& red, int& alpha)
+    {
+        blue = bytes[0] | bytes[1] << 8;
+        green = bytes[2] | bytes[3] << 8;
+        red = bytes[4] | bytes[5] << 8;
+        alpha = 65535;
+    }
+};
+
+/** Helper function - decode one stored row into pixels of format P
+ * @param - row bytes from the file
+ * @param - number of pixels in the row
+ * @param - palette (8-bit files only)
+ * @param - output row
+*/
+template <typename P, int BPP>
+void decode_row(const unsigned char* bytes, int width, const vector<BGRA32>& palette, vector<P>& row)
+{
+    typedef Bmp_Layout<BPP> Layout;
+    const int depth = Pixel_Format<P>::depth;
+    for (int j = 0; j < width; j++)
+    {
+        int blue, green, red, alpha;
+        Layout::read(bytes + j * (BPP / 8), palette, blue, green, red, alpha);
+        row[j] = Pixel_Format<P>::from_bgra(convert_depth<Layout::depth, depth>(blue),
+                                            convert_depth<Layout::depth, depth>(green),
+                                            convert_depth<Layout::depth, depth>(red),
+                                            convert_depth<Layout::depth, depth>(alpha));
+    }
+}
+
+/**
+ * Reads the BMP image specified into pixel format P
+ * Accepts 8 (palette), 24, 32 and 48 bits per pixel. 48-bit is not a
+ * standard BMP layout; it is what write_image_as uses for 16-bit channels.
+ * @param filename BMP image filename
+ * @return the image as a vector of vector of P (empty if not valid)
+ */
+template <typename P>
+vector<vector<P>> read_image_as(string filename)
+{
+    fstream stream;
+    stream.open(filename, ios::in | ios::binary);
+    if (!stream.is_open()) { return {}; }
+
+    // Get the image properties
+    int file_size = get_int(stream, 2, 4);
+    int start = get_int(stream, 10, 4);
+    int dib_size = get_int(stream, 14, 4);
+    int width = get_int(stream, 18, 4);
+    int height = get_int(stream, 22, 4);
+    int bits_per_pixel = get_int(stream, 28, 2);
+    int colors_used = get_int(stream, 46, 4);
+
+    if (bits_per_pixel != 8 && bits_per_pixel != 24 && bits_per_pixel != 32 && bits_per_pixel != 48)
+    {
+        return {};
+    }
+
+    // Scan lines must occupy multiples of four bytes
+    int scanline_size = width * (bits_per_pixel / 8);
+    int padding = (4 - scanline_size % 4) % 4;
+
+    // Return empty vector if this is not a valid image
+    if (width <= 0 || height <= 0 || file_size != start + (scanline_size + padding) * height)
+    {
+        return {};
+    }
+
+    // 8-bit images store colors in a palette after the headers
+    vector<BGRA32> palette(256, BGRA32{0, 0, 0, 255});
+    if (bits_per_pixel == 8)
+    {
+        if (colors_used <= 0 || colors_used > 256) { colors_used = 256; }
+        stream.seekg(14 + dib_size);
+        for (int k = 0; k < colors_used; k++)
+        {
+            palette[k].blue = stream.get();
+            palette[k].green = stream.get();
+            palette[k].red = stream.get();
+            stream.get();
+        }
+    }
+
+    vector<vector<P>> image(height, vector<P>(width));
+    vector<unsigned char> bytes(scanline_size + padding);
+
+    // pick the decoder once, not per pixel
+    void (*decode)(const unsigned char*, int, const vector<BGRA32>&, vector<P>&) = nullptr;
+    if (bits_per_pixel == 8) { decode = decode_row<P, 8>; }
+    else if (bits_per_pixel == 24) { decode = decode_row<P, 24>; }
+    else if (bits_per_pixel == 32) { decode = decode_row<P, 32>; }
+    else { decode = decode_row<P, 48>; }
+
+    // Note: BMP files store rows from bottom to top
+    stream.seekg(start);
+    for (int i = height - 1; i >= 0; i--)
+    {
+        stream.read((char*)bytes.data(), bytes.size());
+        decode(bytes.data(), width, palette, image[i]);
+    }
+
+    // the header matched but the file was cut short
+    if (!stream) { return {}; }
+
+    stream.close();
+    return image;
+}
+
+/** Helper function - store one pixel of format P in its BMP layout
+ * @param - pixel
+ * @param - output bytes (Pixel_Format<P>::bits_per_pixel / 8 of them)
+*/
+template <typename P>
+inline void encode_pixel(const P& pixel, unsigned char* bytes)
+{
+    typedef Pixel_Format<P> Format;
+    int blue, green, red, alpha;
+    Format::to_bgra(pixel, blue, green, red, alpha);
+    if (Format::bits_per_pixel == 8)
+    {
+        bytes[0] = blue;
+    }
+    else if (Format::depth == 8)
+    {
+        bytes[0] = blue; bytes[1] = green; bytes[2] = red;
+        if (Format::bits_per_pixel == 32) { bytes[3] = alpha; }
+    }
+    else
+    {
+        bytes[0] = blue; bytes[1] = blue >> 8;
+        bytes[2] = green; bytes[3] = green >> 8;
+        bytes[4] = red; bytes[5] = red >> 8;
+    }
+}
+
+/**
+ * Write an image of pixel format P to a BMP file, using the format's
+ * bits_per_pixel (8-bit gray images get a gray palette)
+ * @param filename The BMP file name to save the image to
+ * @param image    The input image to save
+ * @return True if successful and false otherwise
+ */
+template <typename P>
+bool write_image_as(string filename, const vector<vector<P>>& image)
+{
+    typedef Pixel_Format<P> Format;
+    const int bytes_per_pixel = Format::bits_per_pixel / 8;
+    const int palette_colors = Format::bits_per_pixel == 8 ? 256 : 0;
+
+    int width_pixels = image[0].size();
+    int height_pixels = image.size();
+    int width_bytes = width_pixels * bytes_per_pixel;
+    int padding_bytes = (4 - width_bytes % 4) % 4;
+
+    fstream stream;
+    stream.open(filename, ios::out | ios::binary);
+    if (!stream.is_open())
+    {
+        return false;
+    }
+
+    if (write_bmp_header(stream, width_pixels, height_pixels, Format::bits_per_pixel, palette_colors) < 0)
+    {
+        stream.close();
+        remove(filename.c_str());
+        return false;
+    }
+
+    // Pixel Array (Left to right, bottom to top, with padding)
+    vector<unsigned char> row(width_bytes + padding_bytes, 0);
+    for (int h = height_pixels - 1; h >= 0; h--)
+    {
+        for (int w = 0; w < width_pixels; w++)
+        {
+            encode_pixel(image[h][w], row.data() + w * bytes_per_pixel);
+        }
+        stream.write((char*)row.data(), row.size());
+    }
+
+    stream.close();
+    return true;
+}
+
+/** Helper function - convert an image between pixel formats (including
+ * the menu's Pixel), changing depth as needed
+ * @param - input image
+ * @return - image in format To
+*/
+template <typename To, typename From>
+vector<vector<To>> convert_format(const vector<vector<From>>& image)
+{
+    const int from_depth = Pixel_Format<From>::depth;
+    const int to_depth = Pixel_Format<To>::depth;
+    int num_rows = image.size(); 
+    int num_cols = image[0].size(); 
+    
+    vector<vector<To>> new_image(num_rows, vector<To>(num_cols)); 
+    for (int i = 0; i < num_rows; i++)
+    {
+        for (int j = 0; j < num_cols; j++)
+        {
+            int blue, green, red, alpha;
+            Pixel_Format<From>::to_bgra(image[i][j], blue, green, red, alpha);
+            new_image[i][j] = Pixel_Format<To>::from_bgra(convert_depth<from_depth, to_depth>(blue),
+                                                          convert_depth<from_depth, to_depth>(green),
+                                                          convert_depth<from_depth, to_depth>(red),
+                                                          convert_depth<from_depth, to_depth>(alpha));
+        }
+    }
+    return new_image;
+}
+
+/** Helper function - copy alpha from one image to another of the same size,
+ * for results computed by the 8-bit kernels
+ * @param - image with the original alpha
+ * @param - image to update
+*/
+template <typename From, typename To>
+void keep_alpha(const vector<vector<From>>& image, vector<vector<To>>& new_image)
+{
+    const int from_depth = Pixel_Format<From>::depth;
+    const int to_depth = Pixel_Format<To>::depth;
+    for (size_t i = 0; i < new_image.size(); i++)
+    {
+        for (size_t j = 0; j < new_image[i].size(); j++)
+        {
+            int blue, green, red, alpha, unused;
+            Pixel_Format<From>::to_bgra(image[i][j], unused, unused, unused, alpha);
+            Pixel_Format<To>::to_bgra(new_image[i][j], blue, green, red, unused);
+            new_image[i][j] = Pixel_Format<To>::from_bgra(blue, green, red, convert_depth<from_depth, to_depth>(alpha));
+        }
+    }
+}
+
+/** Gray scale kernel, format P - output is single channel
+ * @param - input image
+ * @param - number of threads
+ * @return - gray image of the same depth
+*/
+template <typename P>
+vector<vector<typename Pixel_Format<P>::gray_type>> apply_gray_scale_as(const vector<vector<P>>& image, int num_threads)
+{
+    typedef typename Pixel_Format<P>::gray_type G;
+    return build_image_banded<G>(image.size(), image[0].size(), [&](int i, int j)
+    {
+        return Pixel_Format<G>::make_gray(Pixel_Format<P>::color_sum(image[i][j]) / 3);
+    }, num_threads);
+}
+
+/** High-contrast kernel, format P - output is single channel
+ * @param - input image
+ * @param - number of threads
+ * @return - black and white image of the same depth
+*/
+template <typename P>
+vector<vector<typename Pixel_Format<P>::gray_type>> apply_high_contrast_as(const vector<vector<P>>& image, int num_threads)
+{
+    typedef typename Pixel_Format<P>::gray_type G;
+    const int max_value = Pixel_Format<P>::max_value;
+    return build_image_banded<G>(image.size(), image[0].size(), [&](int i, int j)
+    {
+        // same threshold as apply_high_contrast (average >= max / 2)
+        int color_sum = Pixel_Format<P>::color_sum(image[i][j]);
+        return Pixel_Format<G>::make_gray(2 * color_sum >= 3 * max_value ? max_value : 0);
+    }, num_threads);
+}
+
+/** Lighten kernel, format P - alpha is kept, results are clamped
+ * @param - input image
+ * @param - scaling factor
+ * @param - number of threads
+ * @return - output image
+*/
+template <typename P>
+vector<vector<P>> apply_lighten_as(const vector<vector<P>>& image, double scaling_factor, int num_threads)
+{
+    const double max_value = Pixel_Format<P>::max_value;
+    auto lighten = [&](int value) { return clamp(max_value - (max_value - value) * scaling_factor, 0.0, max_value); };
+    return build_image_banded<P>(image.size(), image[0].size(), [&](int i, int j)
+    {
+        return Pixel_Format<P>::map_color(image[i][j], lighten);
+    }, num_threads);
+}
+
+/** Darken kernel, format P - alpha is kept, results are clamped
+ * @param - input image
+ * @param - scaling factor
+ * @param - number of threads
+ * @return - output image
+*/
+template <typename P>
+vector<vector<P>> apply_darken_as(const vector<vector<P>>& image, double scaling_factor, int num_threads)
+{
+    const double max_value = Pixel_Format<P>::max_value;
+    auto darken = [&](int value) { return clamp(value * scaling_factor, 0.0, max_value); };
+    return build_image_banded<P>(image.size(), image[0].size(), [&](int i, int j)
+    {
+        return Pixel_Format<P>::map_color(image[i][j], darken);
+    }, num_threads);
+}
+
+/** Vignette kernel, format P - alpha is kept, results are clamped
+ * @param - input image
+ * @param - number of threads
+ * @return - output image
+*/
+template <typename P>
+vector<vector<P>> apply_vignette_as(const vector<vector<P>>& image, int num_threads)
+{
+    const double max_value = Pixel_Format<P>::max_value;
+    int num_rows = image.size(); 
+    int num_cols = image[0].size(); 
+    return build_image_banded<P>(num_rows, num_cols, [&](int i, int j)
+    {
+        // same falloff as apply_vignette
+        double distance = sqrt(pow((j - num_cols/2.0), 2) + pow((i - num_rows/2.0), 2));
+        double scaling_factor = (num_rows - distance) / num_rows;
+        return Pixel_Format<P>::map_color(image[i][j],
+            [&](int value) { return clamp(value * scaling_factor, 0.0, max_value); });
+    }, num_threads);
+}
+
+/** Clarendon kernel, format P - alpha is kept, results are clamped
+ * @param - input image
+ * @param - scaling factor
+ * @param - number of threads
+ * @return - output image
+*/
+template <typename P>
+vector<vector<P>> apply_clarendon_as(const vector<vector<P>>& image, double scaling_factor, int num_threads)
+{
+    const int max_value = Pixel_Format<P>::max_value;
+    auto lighten = [&](int value) { return clamp(max_value - (max_value - value) * scaling_factor, 0.0, (double)max_value); };
+    auto darken = [&](int value) { return clamp(value * scaling_factor, 0.0, (double)max_value); };
+    return build_image_banded<P>(image.size(), image[0].size(), [&](int i, int j)
+    {
+        // apply_clarendon's 170 and 90 average thresholds, scaled from 255 to max_value
+        int color_sum = Pixel_Format<P>::color_sum(image[i][j]);
+        if (255 * color_sum >= 3 * 170 * max_value) { return Pixel_Format<P>::map_color(image[i][j], lighten); }
+        if (255 * color_sum < 3 * 90 * max_value) { return Pixel_Format<P>::map_color(image[i][j], darken); }
+        return image[i][j];
+    }, num_threads);
+}
+
+/** Black, white, red, green, blue kernel, format P - alpha is kept,
+ * gray input gives color output of the same depth
+ * @param - input image
+ * @param - number of threads
+ * @return - output image
+*/
+template <typename P>
+vector<vector<typename Pixel_Format<P>::color_type>> apply_bwrgb_as(const vector<vector<P>>& image, int num_threads)
+{
+    typedef typename Pixel_Format<P>::color_type C;
+    const int max_value = Pixel_Format<P>::max_value;
+    return build_image_banded<C>(image.size(), image[0].size(), [&](int i, int j)
+    {
+        int blue, green, red, alpha;
+        Pixel_Format<P>::to_bgra(image[i][j], blue, green, red, alpha);
+        int max_color = max(red, max(green, blue));
+        
+        // bwrgb_color's 550 and 150 sum thresholds, scaled from 255 to max_value
+        int color_sum = blue + green + red;
+        if (255 * color_sum >= 550 * max_value) { return Pixel_Format<C>::from_bgra(max_value, max_value, max_value, alpha); }
+        if (255 * color_sum <= 150 * max_value) { return Pixel_Format<C>::from_bgra(0, 0, 0, alpha); }
+        if (max_color == red) { return Pixel_Format<C>::from_bgra(0, 0, max_value, alpha); }
+        if (max_color == green) { return Pixel_Format<C>::from_bgra(0, max_value, 0, alpha); }
+        return Pixel_Format<C>::from_bgra(max_value, 0, 0, alpha);
+    }, num_threads);
+}
+
+//
+// LAZY VIEWS
+//
+// Rotate, flip, crop and enlarge only move pixels around, so instead of
+// building a new image for each one, an Image_View keeps a pointer to the
+// source and a list of coordinate mappings. Stages of the same kind are
+// combined as they are added (rotate + rotate is one 180 degree turn, four
+// turns cancel out, crops add up, enlarge factors multiply). Pixels are
+// only looked up when the view is written, one scanline at a time.
+//
+
+/**
+ * One coordinate mapping of an Image_View
+ */
+struct View_Stage
+{
+    enum Kind { ORIENT, CROP, SCALE };
+    Kind kind = ORIENT;
+    int quarter_turns = 0;          // ORIENT - clockwise turns, applied first
+    bool flipped = false;           // ORIENT - then mirrored left to right
+    int row = 0;                    // CROP - top left corner
+    int col = 0;
+    int x_scaling_factor = 1;       // SCALE
+    int y_scaling_factor = 1;
+    int num_rows = 0;               // size of the image after this stage
+    int num_cols = 0;
+};
+
+/**
+ * A source image of pixel format P plus the stages applied to it, source first
+ */
+template <typename P>
+struct Basic_Image_View
+{
+    const vector<vector<P>>* source = nullptr;
+    vector<View_Stage> stages;
+    
+    int num_rows() const { return stages.empty() ? source->size() : stages.back().num_rows; }
+    int num_cols() const { return stages.empty() ? (*source)[0].size() : stages.back().num_cols; }
+};
+
+typedef Basic_Image_View<Pixel> Image_View;
+
+/** Helper function - view of an image with no transforms
+ * @param - source image, must outlive the view
+ * @return - view
+*/
+
+template <typename P>
+Basic_Image_View<P> make_view(const vector<vector<P>>& image)
+{
+    Basic_Image_View<P> view;
+    view.source = &image;
+    return view;
+}
+
+/** Helper function - add (or merge) a rotate/flip stage
+ * Flipping reverses the direction of any turns that come after it, so a
+ * turn added on top of a flipped stage is subtracted.
+ * @param - view
+ * @param - clockwise quarter turns to add
+ * @param - whether to mirror left to right afterwards
+ * @return - new view
+*/
+
+template <typename P>
+Basic_Image_View<P> view_orient(Basic_Image_View<P> view, int quarter_turns, bool flip)
+{
+    if (view.stages.empty() || view.stages.back().kind != View_Stage::ORIENT)
+    {
+        View_Stage stage;
+        stage.kind = View_Stage::ORIENT;
+        stage.num_rows = view.num_rows();
+        stage.num_cols = view.num_cols();
+        view.stages.push_back(stage);
+    }
+    
+    View_Stage& stage = view.stages.back();
+    bool odd_turns = ((quarter_turns % 4) + 4) % 2 == 1;
+    stage.quarter_turns += stage.flipped ? -quarter_turns : quarter_turns;
+    stage.quarter_turns = ((stage.quarter_turns % 4) + 4) % 4;
+    stage.flipped = stage.flipped != flip;
+    if (odd_turns) { swap(stage.num_rows, stage.num_cols); }
+    
+    // drop the stage if the turns cancelled out
+    if (stage.quarter_turns == 0 && !stage.flipped) { view.stages.pop_back(); }
+    return view;
+}
+
+/** Rotate a view clockwise by multiples of 90 degrees
+ * @param - view
+ * @param - number of quarter turns (negative turns the other way)
+ * @return - new view
+*/
+
+template <typename P>
+Basic_Image_View<P> view_rotate(const Basic_Image_View<P>& view, int num_rotations)
+{
+    return view_orient(view, num_rotations, false);
+}
+
+/** Mirror a view left to right
+ * @param - view
+ * @return - new view
+*/
+
+template <typename P>
+Basic_Image_View<P> view_flip(const Basic_Image_View<P>& view)
+{
+    return view_orient(view, 0, true);
+}
+
+/** Crop a view
+ * @param - view
+ * @param - top row and left column of the crop, in view coordinates
+ * @param - height and width of the crop (must fit inside the view)
+ * @return - new view
+*/
+
+template <typename P>
+Basic_Image_View<P> view_crop(Basic_Image_View<P> view, int row, int col, int num_rows, int num_cols)
+{
+    if (!view.stages.empty() && view.stages.back().kind == View_Stage::CROP)
+    {
+        // a crop of a crop is one crop
+        view.stages.back().row += row;
+        view.stages.back().col += col;
+    }
+    else
+    {
+        View_Stage stage;
+        stage.kind = View_Stage::CROP;
+        stage.row = row;
+        stage.col = col;
+        view.stages.push_back(stage);
+    }
+    view.stages.back().num_rows = num_rows;
+    view.stages.back().num_cols = num_cols;
+    return view;
+}
+
+/** Helper function - check that an enlarged view's size still fits in an int
+ * @param - view
+ * @param - x scaling factor
+ * @param - y scaling factor
+ * @return - True if view_enlarge can apply these factors
+*/
+
+template <typename P>
+bool enlarge_fits(const Basic_Image_View<P>& view, int x_scaling_factor, int y_scaling_factor)
+{
+    return (long long)view.num_rows() * y_scaling_factor <= INT_MAX
+        && (long long)view.num_cols() * x_scaling_factor <= INT_MAX;
+}
+
+/** Enlarge a view, nearest neighbor
+ * @param - view
+ * @param - x scaling factor
+ * @param - y scaling factor
+ * @return - new view (unchanged if !enlarge_fits)
+*/
+
+template <typename P>
+Basic_Image_View<P> view_enlarge(Basic_Image_View<P> view, int x_scaling_factor, int y_scaling_factor)
+{
+    if (!enlarge_fits(view, x_scaling_factor, y_scaling_factor)) { return view; }
+    int num_rows = view.num_rows() * y_scaling_factor;
+    int num_cols = view.num_cols() * x_scaling_factor;
+    if (!view.stages.empty() && view.stages.back().kind == View_Stage::SCALE)
+    {
+        // (i / a) / b == i / (a * b) for whole numbers, so the factors multiply
+        view.stages.back().x_scaling_factor *= x_scaling_factor;
+        view.stages.back().y_scaling_factor *= y_scaling_factor;
+    }
+    else
+    {
+        View_Stage stage;
+        stage.kind = View_Stage::SCALE;
+        stage.x_scaling_factor = x_scaling_factor;
+        stage.y_scaling_factor = y_scaling_factor;
+        view.stages.push_back(stage);
+    }
+    view.stages.back().num_rows = num_rows;
+    view.stages.back().num_cols = num_cols;
+    return view;
+}
+
+/** Helper function - look up a pixel of a view in its source
+ * @param - view
+ * @param - row, in view coordinates
+ * @param - column, in view coordinates
+ * @return - source pixel
+*/
+
+template <typename P>
+const P& view_pixel(const Basic_Image_View<P>& view, int row, int col)
+{
+    // walk the stages backwards, from the view to the source
+    for (int s = view.stages.size() - 1; s >= 0; s--)
+    {
+        const View_Stage& stage = view.stages[s];
+        if (stage.kind == View_Stage::SCALE)
+        {
+            row = row / stage.y_scaling_factor;
+            col = col / stage.x_scaling_factor;
+        }
+        else if (stage.kind == View_Stage::CROP)
+        {
+            row = row + stage.row;
+            col = col + stage.col;
+        }
+        else
+        {
+            if (stage.flipped) { col = stage.num_cols - 1 - col; }
+            
+            // size of the image before this stage
+            int in_rows = stage.quarter_turns % 2 == 0 ? stage.num_rows : stage.num_cols;
+            int in_cols = stage.quarter_turns % 2 == 0 ? stage.num_cols : stage.num_rows;
+            int new_row = row;
+            if (stage.quarter_turns == 1) { new_row = in_rows - 1 - col; col = row; }
+            else if (stage.quarter_turns == 2) { new_row = in_rows - 1 - row; col = in_cols - 1 - col; }
+            else if (stage.quarter_turns == 3) { new_row = col; col = in_cols - 1 - row; }
+            row = new_row;
+        }
+    }
+    return (*view.source)[row][col];
+}
+
+/** Build a real image from a view
+ * @param - view
+ * @return - new image
+*/
+
+template <typename P>
+vector<vector<P>> materialize_view(const Basic_Image_View<P>& view)
+{
+    int num_rows = view.num_rows();
+    int num_cols = view.num_cols();
+    vector<vector<P>> new_image(num_rows, vector<P>(num_cols)); 
+    for (int i = 0; i < num_rows; i++)
+    {
+        for (int j = 0; j < num_cols; j++)
+        {
+            new_image[i][j] = view_pixel(view, i, j);
+        }
+    }
+    return new_image;
+}
+
+/**
+ * Write a view to a BMP file one scanline at a time, so only one row of
+ * the output is ever in memory. The file uses the layout of the source's
+ * pixel format (24-bit for Pixel).
+ * @param filename The BMP file name to save the image to
+ * @param view     The view to save
+ * @return True if successful and false otherwise
+ */
+template <typename P>
+bool write_view(string filename, const Basic_Image_View<P>& view)
+{
+    typedef Pixel_Format<P> Format;
+    const int bytes_per_pixel = Format::bits_per_pixel / 8;
+    const int palette_colors = Format::bits_per_pixel == 8 ? 256 : 0;
+    int num_rows = view.num_rows();
+    int num_cols = view.num_cols();
+    
+    fstream stream;
+    stream.open(filename, ios::out | ios::binary);
+    if (!stream.is_open())
+    {
+        return false;
+    }
+    
+    int row_bytes = write_bmp_header(stream, num_cols, num_rows, Format::bits_per_pixel, palette_colors);
+    if (row_bytes < 0)
+    {
+        stream.close();
+        remove(filename.c_str());
+        return false;
+    }
+    vector<unsigned char> row(row_bytes, 0);
+    
+    // Pixel Array (Left to right, bottom to top, with padding)
+    for (int i = num_rows - 1; i >= 0; i--)
+    {
+        for (int j = 0; j < num_cols; j++)
+        {
+            encode_pixel(view_pixel(view, i, j), row.data() + j * bytes_per_pixel);
+        }
+        stream.write((char*)row.data(), row.size());
+    }
+    
+    stream.close();
+    return true;
+}
+
+//
+// DITHERING
+//
+// High contrast and B/W/R/G/B map every pixel to a few colors, which bands
+// on gradients. Error diffusion pushes each pixel's rounding error onto
+// neighbors that have not been quantized yet; that makes each row depend
+// on the one above, so rows are pipelined across threads: a row may only
+// work on a chunk of columns once the row above has finished one column
+// past the chunk. Ordered
+// dithering adds a fixed Bayer pattern instead and has no dependencies.
+//
+
+enum Dither_Mode { NO_DITHER, FLOYD_STEINBERG, ATKINSON, ORDERED_DITHER };
+
+/** Helper function - prompt for a dithering mode
+ * @return - chosen mode
+*/
+
+Dither_Mode prompt_dither_mode()
+{
+    int mode = -1;
+    while (mode < NO_DITHER || mode > ORDERED_DITHER)
+    {
+        cout << "Dithering - 0) None  1) Floyd-Steinberg  2) Atkinson  3) Ordered (Bayer): ";
+        cin >> mode;
+        if (cin.fail()) { cin.clear(); cin.ignore(1000, '\n'); mode = -1; }
+    }
+    return (Dither_Mode)mode;
+}
+
+/** Helper function - B/W/R/G/B color for a pixel
+ * @param - red, green, blue values
+ * @return - black, white, red, green or blue
+*/
+
+Pixel bwrgb_color(int red_value, int green_value, int blue_value)
+{
+    // figure out which color has highest value
+    int max_color = red_value;
+    if (green_value > max_color)
+    {
+       max_color = green_value;
+    }
+    if (blue_value > max_color)
+    {
+       max_color = blue_value;  
+    }
+    
+    if (red_value + green_value + blue_value >= 550) { return {255, 255, 255}; }
+    else if (red_value + green_value + blue_value <= 150) { return {0, 0, 0}; }
+    else if (max_color == red_value) { return {255, 0, 0}; }
+    else if (max_color == green_value) { return {0, 255, 0}; }
+    else { return {0, 0, 255}; }
+}
+
+/**
+ * One neighbor that receives part of a pixel's error
+ */
+struct Diffusion_Tap
+{
+    int row;        // rows below
+    int col;        // columns to the right (negative is left)
+    float weight;
+};
+
+struct Floyd_Steinberg_Kernel
+{
+    static constexpr int rows_below = 1;
+    static constexpr int num_taps = 4;
+    static constexpr Diffusion_Tap taps[num_taps] = {
+        {0, 1, 7/16.0f}, {1, -1, 3/16.0f}, {1, 0, 5/16.0f}, {1, 1, 1/16.0f} };
+};
+
+struct Atkinson_Kernel
+{
+    // only 6/8 of the error is passed on
+    static constexpr int rows_below = 2;
+    static constexpr int num_taps = 6;
+    static constexpr Diffusion_Tap taps[num_taps] = {
+        {0, 1, 1/8.0f}, {0, 2, 1/8.0f}, {1, -1, 1/8.0f}, {1, 0, 1/8.0f}, {1, 1, 1/8.0f}, {2, 0, 1/8.0f} };
+};
+
+/**
+ * Quantizer for high contrast - one gray channel, black or white
+ */
+struct High_Contrast_Quantizer
+{
+    static const int channels = 1;
+    static void load(const Pixel& pixel, float* value)
+    {
+        value[0] = (pixel.red + pixel.green + pixel.blue) / 3.0f;
+    }
+    static Pixel quantize(const float* value, float* quantized)
+    {
+        quantized[0] = value[0] >= 255/2.0f ? 255 : 0;
+        int gray = quantized[0];
+        return {gray, gray, gray};
+    }
+};
+
+/**
+ * Quantizer for B/W/R/G/B - three channels, five colors
+ */
+struct Bwrgb_Quantizer
+{
+    static const int channels = 3;
+    static void load(const Pixel& pixel, float* value)
+    {
+        value[0] = pixel.red;
+        value[1] = pixel.green;
+        value[2] = pixel.blue;
+    }
+    static Pixel quantize(const float* value, float* quantized)
+    {
+        Pixel color = bwrgb_color(lround(clamp(value[0], 0.0f, 255.0f)),
+                                  lround(clamp(value[1], 0.0f, 255.0f)),
+                                  lround(clamp(value[2], 0.0f, 255.0f)));
+        quantized[0] = color.red;
+        quantized[1] = color.green;
+        quantized[2] = color.blue;
+        return color;
+    }
+};
+
+/** Error diffusion, rows pipelined across threads
+ * Row i goes to thread i % num_threads. Error going right stays in local
+ * carries, so each row's error buffer is only written by rows above it,
+ * and a row waits (per chunk of columns) until the row above has finished
+ * one column past the chunk. The result is the same for any thread count.
+ * That wait also means a row has read a column of its error before any
+ * row Kernel::rows_below + 1 further down can write there, so the error
+ * rows form a ring of that many slots, each value zeroed as it is read.
+ * @param - input image
+ * @param - number of worker threads
+ * @return - dithered image
+*/
+
+template <typename Kernel, typename Quantizer>
+vector<vector<Pixel>> error_diffuse(const vector<vector<Pixel>>& image, int num_threads)
+{
+    const int C = Quantizer::channels;
+    const int CHUNK = 64;
+    int num_rows = image.size(); 
+    int num_cols = image[0].size(); 
+    
+    // rows are shared out round robin; each thread sizes its own output
+    // rows first, so they are placed on its NUMA node
+    vector<vector<Pixel>> new_image(num_rows); 
+    
+    // error pushed down to later rows, C values per pixel, row i in slot i % ring_rows
+    const int ring_rows = Kernel::rows_below + 1;
+    vector<float> error((size_t)ring_rows * num_cols * C, 0.0f);
+    
+    // columns finished in each row
+    unique_ptr<atomic<int>[]> progress(new atomic<int>[num_rows]);
+    for (int i = 0; i < num_rows; i++) { progress[i].store(0); }
+    
+    run_in_parallel(num_threads, [&](int t)
+    {
+        for (int i = t; i < num_rows; i += num_threads)
+        {
+            new_image[i].assign(num_cols, Pixel());
+        }
+    });
+    
+    run_in_parallel(num_threads, [&](int t)
+    {
+        for (int i = t; i < num_rows; i += num_threads)
+        {
+            // error for the next two pixels in this row
+            float carry[2][C] = {};
+            
+            for (int first_col = 0; first_col < num_cols; first_col += CHUNK)
+            {
+                int end_col = min(first_col + CHUNK, num_cols);
+                if (i > 0)
+                {
+                    int needed = min(end_col + 1, num_cols);
+                    while (progress[i - 1].load(memory_order_acquire) < needed) { this_thread::yield(); }
+                }
+                
+                for (int j = first_col; j < end_col; j++)
+                {
+                    float value[C];
+                    float quantized[C];
+                    float* pixel_error = &error[((size_t)(i % ring_rows) * num_cols + j) * C];
+                    Quantizer::load(image[i][j], value);
+                    for (int k = 0; k < C; k++)
+                    {
+                        value[k] += pixel_error[k] + carry[0][k];
+                        pixel_error[k] = 0;     // free for row i + ring_rows
+                    }
+                    
+                    new_image[i][j] = Quantizer::quantize(value, quantized);
+                    
+                    // move the carries along one pixel
+                    for (int k = 0; k < C; k++)
+                    {
+                        carry[0][k] = carry[1][k];
+                        carry[1][k] = 0;
+                    }
+                    
+                    for (int tap = 0; tap < Kernel::num_taps; tap++)
+                    {
+                        const Diffusion_Tap& d = Kernel::taps[tap];
+                        int row = i + d.row;
+                        int col = j + d.col;
+                        if (row >= num_rows || col < 0 || col >= num_cols) { continue; }
+                        
+                        float* target = d.row == 0 ? carry[d.col - 1]
+                                                   : &error[((size_t)(row % ring_rows) * num_cols + col) * C];
+                        for (int k = 0; k < C; k++) { target[k] += d.weight * (value[k] - quantized[k]); }
+                    }
+                }
+                progress[i].store(end_col, memory_order_release);
+            }
+        }
+    });
+    return new_image;
+}
+
+// 8x8 Bayer matrix, thresholds 0-63
+const int BAYER_8[8][8] = {
+    { 0, 32,  8, 40,  2, 34, 10, 42},
+    {48, 16, 56, 24, 50, 18, 58, 26},
+    {12, 44,  4, 36, 14, 46,  6, 38},
+    {60, 28, 52, 20, 62, 30, 54, 22},
+    { 3, 35, 11, 43,  1, 33,  9, 41},
+    {51, 19, 59, 27, 49, 17, 57, 25},
+    {15, 47,  7, 39, 13, 45,  5, 37},
+    {63, 31, 55, 23, 61, 29, 53, 21} };
+
+/** Ordered (Bayer) high contrast
+ * Each row is split into channel arrays and compared against a tiled row
+ * of thresholds with no branches, so the inner loops vectorize. Rows are
+ * independent and split between threads.
+ * @param - input image
+ * @param - number of worker threads
+ * @return - dithered image
+*/
+
+vector<vector<Pixel>> ordered_high_contrast(const vector<vector<Pixel>>& image, int num_threads)
+{
+    int num_rows = image.size(); 
+    int num_cols = image[0].size(); 
+    vector<vector<Pixel>> new_image(num_rows); 
+    
+    run_in_parallel(num_threads, [&](int t)
+    {
+        int first_row, end_row;
+        row_band(t, num_threads, num_rows, first_row, end_row);
+        allocate_band(new_image, first_row, end_row, num_cols);
+        
+        // thresholds as 3x the gray value, so the sum of R,G,B can be compared directly
+        vector<int> sum(num_cols), threshold(num_cols), gray(num_cols);
+        for (int i = first_row; i < end_row; i++)
+        {
+            for (int j = 0; j < num_cols; j++)
+            {
+                // (b + 0.5) / 64 * 255 * 3, averages to the usual 127.5
+                threshold[j] = ((2 * BAYER_8[i % 8][j % 8] + 1) * 255 * 3) / 128;
+                sum[j] = image[i][j].red + image[i][j].green + image[i][j].blue;
+            }
+            for (int j = 0; j < num_cols; j++)
+            {
+                gray[j] = sum[j] >= threshold[j] ? 255 : 0;
+            }
+            for (int j = 0; j < num_cols; j++)
+            {
+                new_image[i][j] = {gray[j], gray[j], gray[j]};
+            }
+        }
+    });
+    return new_image;
+}
+
+/** Ordered (Bayer) B/W/R/G/B
+ * Adds a Bayer offset to each channel, then picks the color with the same
+ * rules as bwrgb_color written without branches, so the loops vectorize.
+ * @param - input image
+ * @param - number of worker threads
+ * @return - dithered image
+*/
+
+vector<vector<Pixel>> ordered_bwrgb(const vector<vector<Pixel>>& image, int num_threads)
+{
+    // how far the pattern can push a channel either way
+    const int SPREAD = 128;
+    int num_rows = image.size(); 
+    int num_cols = image[0].size(); 
+    vector<vector<Pixel>> new_image(num_rows); 
+    
+    run_in_parallel(num_threads, [&](int t)
+    {
+        int first_row, end_row;
+        row_band(t, num_threads, num_rows, first_row, end_row);
+        allocate_band(new_image, first_row, end_row, num_cols);
+        
+        vector<int> red(num_cols), green(num_cols), blue(num_cols), offset(num_cols);
+        for (int i = first_row; i < end_row; i++)
+        {
+            for (int j = 0; j < num_cols; j++)
+            {
+                offset[j] = ((2 * BAYER_8[i % 8][j % 8] + 1) - 64) * SPREAD / 128;
+                red[j] = image[i][j].red;
+                green[j] = image[i][j].green;
+                blue[j] = image[i][j].blue;
+            }
+            for (int j = 0; j < num_cols; j++)
+            {
+                int r = min(max(red[j] + offset[j], 0), 255);
+                int g = min(max(green[j] + offset[j], 0), 255);
+                int b = min(max(blue[j] + offset[j], 0), 255);
+                int sum = r + g + b;
+                
+                bool white = sum >= 550;
+                bool black = !white && sum <= 150;
+                bool is_red = r >= g && r >= b;
+                bool is_green = !is_red && g >= b;
+                bool is_blue = !is_red && !is_green;
+                
+                red[j] = (white || (!black && is_red)) ? 255 : 0;
+                green[j] = (white || (!black && is_green)) ? 255 : 0;
+                blue[j] = (white || (!black && is_blue)) ? 255 : 0;
+            }
+            for (int j = 0; j < num_cols; j++)
+            {
+                new_image[i][j] = {red[j], green[j], blue[j]};
+            }
+        }
+    });
+    return new_image;
+}
+
+//
+// SUMMED-AREA TABLES
+//
+// A summed-area table holds, for every position, the sum of all values
+// above and to the left of it. The sum over any rectangle is then four
+// lookups, so box filters and local statistics cost the same for any
+// window size.
+//
+
+/**
+ * Summed-area table with an extra row and column of zeros at the top and
+ * left, so sum(i, j) is the total of rows < i and columns < j
+ */
+struct Summed_Area_Table
+{
+    int num_rows = 0;
+    int num_cols = 0;
+    unique_ptr<long long[]> sums;
+    
+    long long sum(int i, int j) const { return sums[(size_t)i * (num_cols + 1) + j]; }
+    
+    /** Total over rows [first_row, end_row) and columns [first_col, end_col) */
+    long long box_sum(int first_row, int first_col, int end_row, int end_col) const
+    {
+        return sum(end_row, end_col) - sum(first_row, end_col) - sum(end_row, first_col) + sum(first_row, first_col);
+    }
+};
+
+/** Build a summed-area table in two parallel prefix scans
+ * First every row is scanned left to right (rows split between threads),
+ * then every column top to bottom (columns split between threads, each
+ * thread still walking memory a row at a time).
+ * @param - number of rows
+ * @param - number of columns
+ * @param - value(i, j) for each position
+ * @param - number of worker threads
+ * @return - table
+*/
+
+template <typename F>
+Summed_Area_Table build_summed_area_table(int num_rows, int num_cols, F value, int num_threads)
+{
+    Summed_Area_Table table;
+    table.num_rows = num_rows;
+    table.num_cols = num_cols;
+    int stride = num_cols + 1;
+    
+    // left uninitialized, so each band of rows is first touched (and
+    // placed) by the thread that computes it
+    table.sums.reset(new long long[(size_t)(num_rows + 1) * stride]);
+    
+    // prefix along each row
+    run_in_parallel(num_threads, [&](int t)
+    {
+        int first_row, end_row;
+        row_band(t, num_threads, num_rows, first_row, end_row);
+        if (t == 0) { fill(&table.sums[0], &table.sums[stride], 0); }
+        for (int i = first_row; i < end_row; i++)
+        {
+            long long* row = &table.sums[(size_t)(i + 1) * stride];
+            row[0] = 0;
+            long long running = 0;
+            for (int j = 0; j < num_cols; j++)
+            {
+                running += value(i, j);
+                row[j + 1] = running;
+            }
+        }
+    });
+    
+    // prefix down each column
+    run_in_parallel(num_threads, [&](int t)
+    {
+        int first_col, end_col;
+        row_band(t, num_threads, num_cols, first_col, end_col);
+        for (int i = 1; i <= num_rows; i++)
+        {
+            long long* above = &table.sums[(size_t)(i - 1) * stride];
+            long long* row = &table.sums[(size_t)i * stride];
+            for (int j = first_col + 1; j <= end_col; j++)
+            {
+                row[j] += above[j];
+            }
+        }
+    });
+    return table;
+}
+
+/** Box blur kernel - average over a (2 * radius + 1) square window
+ * Windows are cut off at the edges of the image. Uses one summed-area
+ * table per channel, so the cost does not depend on the radius.
+ * @param - input image
+ * @param - radius of the window
+ * @param - number of threads
+ * @return - blurred image
+*/
+
+vector<vector<Pixel>> apply_box_blur(const vector<vector<Pixel>>& image, int radius, int num_threads)
+{
+    int num_rows = image.size(); 
+    int num_cols = image[0].size(); 
+    
+    Summed_Area_Table red = build_summed_area_table(num_rows, num_cols,
+        [&](int i, int j) { return image[i][j].red; }, num_threads);
+    Summed_Area_Table green = build_summed_area_table(num_rows, num_cols,
+        [&](int i, int j) { return image[i][j].green; }, num_threads);
+    Summed_Area_Table blue = build_summed_area_table(num_rows, num_cols,
+        [&](int i, int j) { return image[i][j].blue; }, num_threads);
+    
+    vector<vector<Pixel>> new_image(num_rows); 
+    run_in_parallel(num_threads, [&](int t)
+    {
+        int first_row, end_row;
+        row_band(t, num_threads, num_rows, first_row, end_row);
+        allocate_band(new_image, first_row, end_row, num_cols);
+        for (int i = first_row; i < end_row; i++)
+        {
+            int top = max(0, i - radius);
+            int bottom = min(num_rows, i + radius + 1);
+            for (int j = 0; j < num_cols; j++)
+            {
+                int left = max(0, j - radius);
+                int right = min(num_cols, j + radius + 1);
+                long long count = (long long)(bottom - top) * (right - left);
+                
+                // rounded average
+                new_image[i][j].red = (red.box_sum(top, left, bottom, right) + count/2) / count;
+                new_image[i][j].green = (green.box_sum(top, left, bottom, right) + count/2) / count;
+                new_image[i][j].blue = (blue.box_sum(top, left, bottom, right) + count/2) / count;
+            }
+        }
+    });
+    return new_image;
+}
+
+enum Threshold_Mode { GLOBAL_THRESHOLD, BRADLEY_THRESHOLD, SAUVOLA_THRESHOLD };
+
+/** Helper function - prompt for a high contrast threshold mode
+ * @return - chosen mode
+*/
+
+Threshold_Mode prompt_threshold_mode()
+{
+    int mode = -1;
+    while (mode < GLOBAL_THRESHOLD || mode > SAUVOLA_THRESHOLD)
+    {
+        cout << "Threshold - 0) Global  1) Bradley (local mean)  2) Sauvola (local mean and deviation): ";
+        cin >> mode;
+        if (cin.fail()) { cin.clear(); cin.ignore(1000, '\n'); mode = -1; }
+    }
+    return (Threshold_Mode)mode;
+}
+
+/** High-contrast kernel with a local adaptive threshold
+ * Each pixel is compared against statistics of the window around it, so
+ * uneven lighting (e.g. a scanned page) does not push whole areas to
+ * black or white. Bradley: black if more than 15% below the local mean.
+ * Sauvola: threshold = mean * (1 + 0.34 * (deviation / 128 - 1)).
+ * Sums of gray and gray squared come from summed-area tables, so the
+ * cost does not depend on the window size.
+ * @param - input image
+ * @param - BRADLEY_THRESHOLD or SAUVOLA_THRESHOLD
+ * @param - radius of the window
+ * @param - number of threads
+ * @return new image w/ high-contrast applied
+*/
+
+vector<vector<Pixel>> apply_local_threshold(const vector<vector<Pixel>>& image, Threshold_Mode mode, int radius,
+    int num_threads)
+{
+    const double BRADLEY_T = 0.15;
+    const double SAUVOLA_K = 0.34;
+    const double SAUVOLA_R = 128;
+    int num_rows = image.size(); 
+    int num_cols = image[0].size(); 
+    
+    // tables hold 3x the gray value (the sum of R,G,B) to stay in whole numbers
+    auto color_sum = [&](int i, int j) { return (long long)image[i][j].red + image[i][j].green + image[i][j].blue; };
+    Summed_Area_Table sums = build_summed_area_table(num_rows, num_cols, color_sum, num_threads);
+    Summed_Area_Table squares;
+    if (mode == SAUVOLA_THRESHOLD)
+    {
+        squares = build_summed_area_table(num_rows, num_cols,
+            [&](int i, int j) { return color_sum(i, j) * color_sum(i, j); }, num_threads);
+    }
+    
+    vector<vector<Pixel>> new_image(num_rows); 
+    run_in_parallel(num_threads, [&](int t)
+    {
+        int first_row, end_row;
+        row_band(t, num_threads, num_rows, first_row, end_row);
+        allocate_band(new_image, first_row, end_row, num_cols);
+        for (int i = first_row; i < end_row; i++)
+        {
+            int top = max(0, i - radius);
+            int bottom = min(num_rows, i + radius + 1);
+            for (int j = 0; j < num_cols; j++)
+            {
+                int left = max(0, j - radius);
+                int right = min(num_cols, j + radius + 1);
+                double count = (double)(bottom - top) * (right - left);
+                double mean = sums.box_sum(top, left, bottom, right) / count / 3.0;
+                double gray_value = color_sum(i, j) / 3.0;
+                
+                double threshold;
+                if (mode == BRADLEY_THRESHOLD)
+                {
+                    threshold = mean * (1 - BRADLEY_T);
+                }
+                else
+                {
+                    double mean_square = squares.box_sum(top, left, bottom, right) / count / 9.0;
+                    double deviation = sqrt(max(0.0, mean_square - mean * mean));
+                    threshold = mean * (1 + SAUVOLA_K * (deviation / SAUVOLA_R - 1));
+                }
+                
+                int value = gray_value > threshold ? 255 : 0;
+                new_image[i][j] = {value, value, value};
+            }
+        }
+    });
+    return new_image;
+}
+
+/**
+ * Vignette kernel for part of a larger image - darkens pixels by distance
+ * from the center of the full image, so a region gets the same falloff it
+ * has in the whole picture
+ * @param input img, vector of pixels
+ * @param top row and left column of the part within the full image
+ * @param height and width of the full image
+ * @return new image with vignette applied
+*/
+vector<vector<Pixel>> apply_vignette_at(const vector<vector<Pixel>>& image, int first_row, int first_col,
+    int full_rows, int full_cols)
+{
+    int num_rows = image.size(); 
+    int num_cols = image[0].size(); 
+    vector<vector<Pixel>> new_image(num_rows, vector<Pixel>(num_cols)); 
+    for (int i = 0; i < num_rows; i++)
+    {
+        for (int j = 0; j < num_cols; j++)
+        {
+            // get original pixel color values
+            int red_value = image[i][j].red;
+            int green_value = image[i][j].green;
+            int blue_value = image[i][j].blue;
+            
+            // find distance to the center
+            double distance = sqrt(pow((first_col + j - full_cols/2.0), 2) + pow((first_row + i - full_rows/2.0), 2));
+            double scaling_factor = (full_rows - distance) / full_rows;
+            
+            // set pixel values for new image
+            new_image[i][j].red = red_value * scaling_factor;
+            new_image[i][j].green = green_value * scaling_factor;
+            new_image[i][j].blue = blue_value * scaling_factor;
+        }
+    }
+    return new_image;
+}
+
+/**
+ * Vignette kernel - darkens pixels by distance from the center
+ * @param input img, vector of pixels
+ * @return new image with vignette applied
+*/
+vector<vector<Pixel>> apply_vignette(const vector<vector<Pixel>>& image)
+{
+    return apply_vignette_at(image, 0, 0, image.size(), image[0].size());
+}
+
+/**
+  * Clarendon kernel - lights lighter/darks darker
+  * @param input image
+  * @param scaling factor
+  * @return new image
+*/
+vector<vector<Pixel>> apply_clarendon(const vector<vector<Pixel>>& image, double scaling_factor)
+{
+    int num_rows = image.size(); 
+    int num_cols = image[0].size(); 
+    
+    // var to store new img
+    vector<vector<Pixel>> new_image(num_rows, vector<Pixel>(num_cols)); 
+    
+    for (int i = 0; i < num_rows; i++)
+    {
+        for (int j = 0; j < num_cols; j++)
+        {
+            // get original pixel color values
+            int red_value = image[i][j].red;
+            int green_value = image[i][j].green;
+            int blue_value = image[i][j].blue;
+            
+            //find average of R,G,B values
+            double average_value = (red_value + green_value + blue_value)/3.0;
+            
+            // If cell is light, make it lighter
+            if (average_value >= 170)
+            {
+                new_image[i][j].red = 255 - (255 - red_value)*scaling_factor;
+                new_image[i][j].green = 255 - (255 - green_value)*scaling_factor;
+                new_image[i][j].blue = 255 - (255 - blue_value)*scaling_factor;
+            }
+            else if (average_value < 90)
+            {
+                new_image[i][j].red = red_value*scaling_factor;
+                new_image[i][j].green = green_value*scaling_factor;
+                new_image[i][j].blue = blue_value*scaling_factor;
+            }
+            else 
+            {
+                new_image[i][j].red = red_value;
+                new_image[i][j].green = green_value;
+                new_image[i][j].blue = blue_value;
+            }
+
+        }
+    }
+    return new_image;
+}
+
+ // 
+
+/**
+  * Gray scale kernel
+  * @param - input image
+  * @return - output image, vector of Pixels
+*/
+
+vector<vector<Pixel>> apply_gray_scale(const vector<vector<Pixel>>& image)
+{
+    // get height and width of original image
+    int num_rows = image.size(); 
+    int num_cols = image[0].size(); 
+    
+    // initialize var to store new img
+    vector<vector<Pixel>> new_image(num_rows, vector<Pixel>(num_cols)); 
+    
+    for (int i = 0; i < num_rows; i++)
+    {
+        for (int j = 0; j < num_cols; j++)
+        {
+            // get original pixel color values
+            int red_value = image[i][j].red;
+            int green_value = image[i][j].green;
+            int blue_value = image[i][j].blue;
+            
+            //find average of R,G,B values
+            double average_value = (red_value + green_value + blue_value)/3.0;
+            
+            // set RGB values to average
+            new_image[i][j].red = average_value;
+            new_image[i][j].green = average_value;
+            new_image[i][j].blue = average_value;
+        }
+    }
+    return new_image;
+}
+
+/** Rotate kernel - rotates by 90 degrees clockwise
+ * @param - input image
+ * @return - rotated image, rows & cols swapped
+*/
+
+vector<vector<Pixel>> apply_rotate_90(const vector<vector<Pixel>>& image)
+{       
+    return materialize_view(view_rotate(make_view(image), 1));
+}
+
+/** Rotate kernel - rotates by multiples of 90 degrees
+ * @param - input image
+ * @param - number of times to rotate (negative rotates the other way)
+ * @return - rotated image
+*/
+
+vector<vector<Pixel>> apply_rotate_90_multiple(const vector<vector<Pixel>>& image, int num_rotations)
+{
+    return materialize_view(view_rotate(make_view(image), num_rotations));
+}
+ 
+/** Enlarge kernel - nearest neighbor in the X and Y directions
+  * @param - input image
+  * @param - x scaling factor
+  * @param - y scaling factor
+  * @return - new image
+*/
+
+vector<vector<Pixel>> apply_enlarge(const vector<vector<Pixel>>& image, int x_scaling_factor, int y_scaling_factor)
+{
+    Image_View view = make_view(image);
+    if (!enlarge_fits(view, x_scaling_factor, y_scaling_factor)) { return {}; }
+    return materialize_view(view_enlarge(view, x_scaling_factor, y_scaling_factor));
+}
+
+ /** High-contrast kernel - B & W only
+  * @param - input image
+  * @return new image w/ high-contrast applied
+*/
+
+vector<vector<Pixel>> apply_high_contrast(const vector<vector<Pixel>>& image)
+{
+    // Get size of original image
+    int num_rows = image.size(); 
+    int num_cols = image[0].size(); 
+
+    // initialize new image object
+    vector<vector<Pixel>> new_image(num_rows, vector<Pixel>(num_cols)); 
+
+
+    for (int i = 0; i < num_rows; i++)
+    {
+        for (int j = 0; j < num_cols; j++)
+        {
+            // get original pixel color values
+            int red_value = image[i][j].red;
+            int green_value = image[i][j].green;
+            int blue_value = image[i][j].blue;
+            
+            // average to find gray values
+            double gray_value = (red_value + green_value + blue_value) / 3.0;
+            
+            // set pixel values for new image
+            if (gray_value >= 255/2.0)
+            {
+                new_image[i][j].red = 255;
+                new_image[i][j].green = 255;
+                new_image[i][j].blue = 255; 
+            }
+            else 
+            {
+                new_image[i][j].red = 0; 
+                new_image[i][j].green = 0; 
+                new_image[i][j].blue = 0;
+            }
+        }
+    }
+    return new_image;
+}
+
+/** High-contrast kernel with dithering
+  * @param - input image
+  * @param - dithering mode
+  * @param - number of threads
+  * @return new image w/ high-contrast applied
+*/
+
+vector<vector<Pixel>> apply_high_contrast_dithered(const vector<vector<Pixel>>& image, Dither_Mode mode, int num_threads)
+{
+    if (mode == FLOYD_STEINBERG) { return error_diffuse<Floyd_Steinberg_Kernel, High_Contrast_Quantizer>(image, num_threads); }
+    if (mode == ATKINSON) { return error_diffuse<Atkinson_Kernel, High_Contrast_Quantizer>(image, num_threads); }
+    if (mode == ORDERED_DITHER) { return ordered_high_contrast(image, num_threads); }
+    return apply_high_contrast(image);
+}
+
+ /** Lighten kernel
+  * @param - input image
+  * @param - scaling factor
+  * @return - output image
+  */
+vector<vector<Pixel>> apply_lighten(const vector<vector<Pixel>>& image, double scaling_factor)
+{
+    // Get size of original image
+    int num_rows = image.size(); 
+    int num_cols = image[0].size(); 
+
+    // initialize new image object
+    vector<vector<Pixel>> new_image(num_rows, vector<Pixel>(num_cols)); 
+
+
+    for (int i = 0; i < num_rows; i++)
+    {
+        for (int j = 0; j < num_cols; j++)
+        {
+            // get original pixel color values
+            int red_value = image[i][j].red;
+            int green_value = image[i][j].green;
+            int blue_value = image[i][j].blue;
+            
+            // lighten image to scaling factor
+            new_image[i][j].red = (255 - (255 - red_value) * scaling_factor);
+            new_image[i][j].green = (255 - (255 - green_value) * scaling_factor);
+            new_image[i][j].blue = (255 - (255 - blue_value) * scaling_factor); 
+        }
+    }
+    return new_image;
+}
+
+  /** Darken kernel
+  * @param - input image
+  * @param - scaling factor
+  * @return - new image
+  */
+    
+vector<vector<Pixel>> apply_darken(const vector<vector<Pixel>>& image, double scaling_factor)
+{
+    // Get size of original image
+    int num_rows = image.size(); 
+    int num_cols = image[0].size(); 
+
+    // initialize new image object
+    vector<vector<Pixel>> new_image(num_rows, vector<Pixel>(num_cols)); 
+
+
+    for (int i = 0; i < num_rows; i++)
+    {
+        for (int j = 0; j < num_cols; j++)
+        {
+            // get original pixel color values
+            int red_value = image[i][j].red;
+            int green_value = image[i][j].green;
+            int blue_value = image[i][j].blue;
+            
+            // set new pixel to scaling factor
+            new_image[i][j].red = red_value * scaling_factor;
+            new_image[i][j].green = green_value * scaling_factor;
+            new_image[i][j].blue = blue_value * scaling_factor; 
+        }
+    }
+    return new_image;
+}
+
+ /** B/W/R/G/B kernel - convert to only blk, wht, rd, blue, grn
+ * @param - input image
+ * @return - output image
+ */ 
+vector<vector<Pixel>> apply_bwrgb(const vector<vector<Pixel>>& image)
+{
+    // Get size of original image
+    int num_rows = image.size(); 
+    int num_cols = image[0].size(); 
+
+    // initialize new image object
+    vector<vector<Pixel>> new_image(num_rows, vector<Pixel>(num_cols)); 
+
+
+    for (int i = 0; i < num_rows; i++)
+    {
+        for (int j = 0; j < num_cols; j++)
+        {
+            // get original pixel color values
+            int red_value = image[i][j].red;
+            int green_value = image[i][j].green;
+            int blue_value = image[i][j].blue;
+            
+            // set new pixel values
+            new_image[i][j] = bwrgb_color(red_value, green_value, blue_value);
+        }
+    }
+    return new_image;
+}
+
+/** B/W/R/G/B kernel with dithering
+ * @param - input image
+ * @param - dithering mode
+ * @param - number of threads
+ * @return - output image
+ */ 
+vector<vector<Pixel>> apply_bwrgb_dithered(const vector<vector<Pixel>>& image, Dither_Mode mode, int num_threads)
+{
+    if (mode == FLOYD_STEINBERG) { return error_diffuse<Floyd_Steinberg_Kernel, Bwrgb_Quantizer>(image, num_threads); }
+    if (mode == ATKINSON) { return error_diffuse<Atkinson_Kernel, Bwrgb_Quantizer>(image, num_threads); }
+    if (mode == ORDERED_DITHER) { return ordered_bwrgb(image, num_threads); }
+    return apply_bwrgb(image);
+}
+
+/**
+ * Parameters for a menu operation, gathered once up front so the
+ * operation can be re-run (on a preview level, then at full resolution)
+ * without prompting again
+ */
+struct Operation_Params
+{
+    int menu_number = 0;
+    double scaling_factor = 1.0;    // clarendon, lighten, darken
+    int num_rotations = 0;          // rotate multiples of 90
+    int x_scaling_factor = 1;       // enlarge
+    int y_scaling_factor = 1;       // enlarge
+    Dither_Mode dither_mode = NO_DITHER;    // high contrast, B/W/R/G/B
+    Threshold_Mode threshold_mode = GLOBAL_THRESHOLD;   // high contrast
+    int radius = 0;                 // local threshold window, box blur
+};
+
+/** Helper function - prompt for the parameters a menu operation needs
+ * @param - menu number of the operation (1-10, 16)
+ * @return - filled in parameters
+*/
+
+Operation_Params prompt_operation_params(int menu_number)
+{
+    Operation_Params params;
+    params.menu_number = menu_number;
+    
+    if (menu_number == 2 || menu_number == 8 || menu_number == 9)
+    {
+        cout << "Enter a scaling factor: ";
+        cin >> params.scaling_factor;
+    }
+    else if (menu_number == 7)
+    {
+        params.threshold_mode = prompt_threshold_mode();
+        if (params.threshold_mode == GLOBAL_THRESHOLD) { params.dither_mode = prompt_dither_mode(); }
+        else
+        {
+            cout << "Enter window radius in pixels: ";
+            cin >> params.radius;
+            params.radius = max(1, params.radius);
+        }
+    }
+    else if (menu_number == 10)
+    {
+        params.dither_mode = prompt_dither_mode();
+    }
+    else if (menu_number == 16)
+    {
+        cout << "Enter blur radius in pixels: ";
+        cin >> params.radius;
+        params.radius = max(0, params.radius);
+    }
+    else if (menu_number == 4)
+    {
+        params.num_rotations = 1;
+    }
+    else if (menu_number == 5)
+    {
+        cout << "How many times would you like to rotate this image? ";
+        cin >> params.num_rotations;
+    }
+    else if (menu_number == 6)
+    {
+        cout << "Enter integer to enlarge in X direction: " << endl;
+        cin >> params.x_scaling_factor;
+        cout << "Enter integer to englarge in Y direction: " << endl;
+        cin >> params.y_scaling_factor;
+    }
+    return params;
+}
+
+/** Helper function - run a menu operation's kernel without any prompts
+ * @param - input image
+ * @param - operation and its parameters
+ * @param - threads for the multi-threaded kernels (1 inside batch workers)
+ * @return - new image (empty if the menu number is not an operation)
+*/
+
+vector<vector<Pixel>> apply_operation(const vector<vector<Pixel>>& image, const Operation_Params& params,
+    int num_threads)
+{
+    switch (params.menu_number)
+    {
+        case 1: return apply_vignette(image);
+        case 2: return apply_clarendon(image, params.scaling_factor);
+        case 3: return apply_gray_scale(image);
+        case 4: return apply_rotate_90(image);
+        case 5: return apply_rotate_90_multiple(image, params.num_rotations);
+        case 6: return apply_enlarge(image, params.x_scaling_factor, params.y_scaling_factor);
+        case 7:
+            if (params.threshold_mode != GLOBAL_THRESHOLD)
+            {
+                return apply_local_threshold(image, params.threshold_mode, params.radius, num_threads);
+            }
+            return apply_high_contrast_dithered(image, params.dither_mode, num_threads);
+        case 8: return apply_lighten(image, params.scaling_factor);
+        case 9: return apply_darken(image, params.scaling_factor);
+        case 10: return apply_bwrgb_dithered(image, params.dither_mode, num_threads);
+        case 16: return apply_box_blur(image, params.radius, num_threads);
+    }
+    return {};
+}
+
+/** Helper function - run a menu operation on an image and save it
+ * Rotations and enlarge are written straight from a view, so their
+ * output is never held in memory.
+ * @param - output file name
+ * @param - input image
+ * @param - operation and its parameters
+ * @param - number of threads
+ * @return - True if successful and false otherwise
+*/
+
+bool write_operation(string filename, const vector<vector<Pixel>>& image, const Operation_Params& params,
+    int num_threads)
+{
+    if (params.menu_number == 4 || params.menu_number == 5)
+    {
+        return write_view(filename, view_rotate(make_view(image), params.num_rotations));
+    }
+    if (params.menu_number == 6)
+    {
+        Image_View view = make_view(image);
+        if (!enlarge_fits(view, params.x_scaling_factor, params.y_scaling_factor)) { return false; }
+        return write_view(filename, view_enlarge(view, params.x_scaling_factor, params.y_scaling_factor));
+    }
+    return write_image(filename, apply_operation(image, params, num_threads));
+}
+
+/** Helper function - box downsample to half size
+ * Each output pixel is the average of the (up to) 2x2 block under it,
+ * odd last rows/cols just average what is there
+ * @param - input image, any pixel format
+ * @return - image with half the rows and cols (rounded up)
+*/
+
+template <typename P>
+vector<vector<P>> downsample_half(const vector<vector<P>>& image)
+{
+    int num_rows = image.size(); 
+    int num_cols = image[0].size(); 
+    int new_rows = (num_rows + 1) / 2;
+    int new_cols = (num_cols + 1) / 2;
+    
+    vector<vector<P>> new_image(new_rows, vector<P>(new_cols)); 
+    
+    for (int i = 0; i < new_rows; i++)
+    {
+        int last_row = min(2*i + 1, num_rows - 1);
+        for (int j = 0; j < new_cols; j++)
+        {
+            int last_col = min(2*j + 1, num_cols - 1);
+            
+            // sum the block
+            int red_sum = 0, green_sum = 0, blue_sum = 0, alpha_sum = 0, count = 0;
+            for (int r = 2*i; r <= last_row; r++)
+            {
+                for (int c = 2*j; c <= last_col; c++)
+                {
+                    int blue, green, red, alpha;
+                    Pixel_Format<P>::to_bgra(image[r][c], blue, green, red, alpha);
+                    red_sum += red;
+                    green_sum += green;
+                    blue_sum += blue;
+                    alpha_sum += alpha;
+                    count++;
+                }
+            }
+            
+            // rounded average
+            new_image[i][j] = Pixel_Format<P>::from_bgra((blue_sum + count/2) / count, (green_sum + count/2) / count,
+                (red_sum + count/2) / count, (alpha_sum + count/2) / count);
+        }
+    }
+    return new_image;
+}
+
+/** Build the image pyramid - 1/2, 1/4 and 1/8 levels for previews
+ * Level 0 (full resolution) is the input image itself and is not copied
+ * @param - input image
+ * @return - levels from 1/2 down to 1/8 (stops early on tiny images)
+*/
+
+template <typename P>
+vector<vector<vector<P>>> build_pyramid(const vector<vector<P>>& image)
+{
+    const int PYRAMID_LEVELS = 3;
+    vector<vector<vector<P>>> pyramid;
+    
+    if (image.empty()) { return pyramid; }
+    
+    const vector<vector<P>>* previous = &image;
+    for (int level = 0; level < PYRAMID_LEVELS; level++)
+    {
+        // no point halving a single row or column any further
+        if (previous->size() < 2 || (*previous)[0].size() < 2) { break; }
+        pyramid.push_back(downsample_half(*previous));
+        previous = &pyramid.back();
+    }
+    return pyramid;
+}
+
+/** Helper function - pick the smallest pyramid level that is still big enough
+ * @param - full resolution image
+ * @param - pyramid levels (1/2, 1/4, 1/8)
+ * @param - target size, in pixels along the longest side
+ * @return - the chosen level (the full image if no level is big enough)
+*/
+
+template <typename P>
+const vector<vector<P>>& select_pyramid_level(const vector<vector<P>>& image,
+    const vector<vector<vector<P>>>& pyramid, int target_size)
+{
+    // walk from the smallest level up
+    for (int level = pyramid.size() - 1; level >= 0; level--)
+    {
+        int longest_side = max(pyramid[level].size(), pyramid[level][0].size());
+        if (longest_side >= target_size) { return pyramid[level]; }
+    }
+    return image;
+}
+
+/**
+ * Layout of a BMP file's pixel array, read from its headers
+ */
+struct Bmp_Info
+{
+    int file_size = 0;
+    int start = 0;              // offset of the pixel array
+    int width = 0;
+    int height = 0;
+    int bits_per_pixel = 0;
+    int row_stride = 0;         // scanline_size + padding
+    bool valid = false;
+};
+
+/** Helper function - read the headers of a BMP file
+ * @param - open binary stream
+ * @return - pixel array layout (valid is false if the sizes do not add up
+ *           or the pixels are not 24 or 32 bit)
+*/
+
+Bmp_Info read_bmp_info(fstream& stream)
+{
+    Bmp_Info info;
+    info.file_size = get_int(stream, 2, 4);
+    info.start = get_int(stream, 10, 4);
+    info.width = get_int(stream, 18, 4);
+    info.height = get_int(stream, 22, 4);
+    info.bits_per_pixel = get_int(stream, 28, 2);
+    
+    // Scan lines must occupy multiples of four bytes
+    int scanline_size = info.width * (info.bits_per_pixel / 8);
+    info.row_stride = scanline_size + (4 - scanline_size % 4) % 4;
+    
+    // readers of this layout take bytes 0-2 of each pixel as 8-bit B,G,R,
+    // which only holds for 24 and 32 bit pixels
+    info.valid = stream.good() && info.width > 0 && info.height > 0
+        && (info.bits_per_pixel == 24 || info.bits_per_pixel == 32)
+        && info.file_size == info.start + info.row_stride * info.height;
+    return info;
+}
+
+/** Helper function - file offset of a pixel
+ * @param - pixel array layout
+ * @param - row, counted from the top like image[row][col]
+ * @param - column
+ * @return - byte offset in the file
+*/
+
+long pixel_offset(const Bmp_Info& info, int row, int col)
+{
+    // Note: BMP files store rows from bottom to top
+    return info.start + (long)(info.height - 1 - row) * info.row_stride + (long)col * (info.bits_per_pixel / 8);
+}
+
+/**
+ * Reads only a rectangle of the BMP image specified
+ * Each row of the rectangle is one seek and one read, so the cost
+ * depends on the size of the rectangle, not the size of the file.
+ * @param filename BMP image filename
+ * @param x        left column of the rectangle
+ * @param y        top row of the rectangle
+ * @param width    width of the rectangle in pixels
+ * @param height   height of the rectangle in pixels
+ * @return the rectangle as a vector of vector of Pixels (empty if the
+ *         file is not valid or the rectangle is not inside the image)
+ */
+vector<vector<Pixel>> read_image_region(string filename, int x, int y, int width, int height)
+{
+    fstream stream;
+    stream.open(filename, ios::in | ios::binary);
+    if (!stream.is_open()) { return {}; }
+    
+    Bmp_Info info = read_bmp_info(stream);
+    if (!info.valid || x < 0 || y < 0 || width <= 0 || height <= 0
+        || x + width > info.width || y + height > info.height)
+    {
+        return {};
+    }
+    
+    int bytes_per_pixel = info.bits_per_pixel / 8;
+    vector<unsigned char> bytes(width * bytes_per_pixel);
+    vector<vector<Pixel>> region(height, vector<Pixel>(width));
+    
+    for (int i = 0; i < height; i++)
+    {
+        stream.seekg(pixel_offset(info, y + i, x));
+        stream.read((char*)bytes.data(), bytes.size());
+        
+        // Note: BMP files store pixels in blue, green, red order
+        for (int j = 0; j < width; j++)
+        {
+            region[i][j].blue = bytes[j * bytes_per_pixel];
+            region[i][j].green = bytes[j * bytes_per_pixel + 1];
+            region[i][j].red = bytes[j * bytes_per_pixel + 2];
+        }
+    }
+    
+    stream.close();
+    return region;
+}
+
+/**
+ * Patches a rectangle of pixels into an existing BMP file in place
+ * Only the bytes under the rectangle are touched; anything beyond blue,
+ * green, red in each pixel (e.g. alpha) is left as it was.
+ * @param filename existing BMP file to patch
+ * @param region   pixels to write
+ * @param x        left column to write at
+ * @param y        top row to write at
+ * @return True if successful and false otherwise
+ */
+bool write_image_region(string filename, const vector<vector<Pixel>>& region, int x, int y)
+{
+    fstream stream;
+    stream.open(filename, ios::in | ios::out | ios::binary);
+    if (!stream.is_open()) { return false; }
+    
+    Bmp_Info info = read_bmp_info(stream);
+    int height = region.size();
+    int width = region[0].size();
+    if (!info.valid || x < 0 || y < 0 || x + width > info.width || y + height > info.height)
+    {
+        return false;
+    }
+    
+    int bytes_per_pixel = info.bits_per_pixel / 8;
+    vector<unsigned char> bytes(width * bytes_per_pixel);
+    
+    for (int i = 0; i < height; i++)
+    {
+        long offset = pixel_offset(info, y + i, x);
+        stream.seekg(offset);
+        stream.read((char*)bytes.data(), bytes.size());
+        
+        for (int j = 0; j < width; j++)
+        {
+            bytes[j * bytes_per_pixel] = region[i][j].blue;
+            bytes[j * bytes_per_pixel + 1] = region[i][j].green;
+            bytes[j * bytes_per_pixel + 2] = region[i][j].red;
+        }
+        
+        stream.seekp(offset);
+        stream.write((char*)bytes.data(), bytes.size());
+    }
+    
+    stream.close();
+    return !stream.fail();
+}
+
+/** Process 13 - Apply an operation to a rectangle only
+ * Decodes just the rectangle from the input file, runs the operation on
+ * it and patches the result into the output file in place. If the output
+ * file does not exist yet it starts as a copy of the input, so several
+ * regions can be edited into the same output one after another.
+ * Windowed filters (box blur, local thresholds) read a margin of radius
+ * pixels around the rectangle so their windows are not cut at its edge,
+ * and vignette is measured from the center of the whole image.
+ * @param - input file name
+ * @param - number of threads
+ * @return - processed region
+*/
+
+vector<vector<Pixel>> process_region(string i_file, int num_threads)
+{
+    cout << "\nProcess a region selected\n" << endl;
+    string output_file = validate_file_name(i_file);
+    
+    fstream input;
+    input.open(i_file, ios::in | ios::binary);
+    Bmp_Info input_info = read_bmp_info(input);
+    input.close();
+    
+    // patching in place only makes sense over an image of the same size
+    fstream existing;
+    existing.open(output_file, ios::in | ios::binary);
+    bool output_exists = existing.is_open();
+    if (output_exists)
+    {
+        Bmp_Info output_info = read_bmp_info(existing);
+        if (!output_info.valid || output_info.width != input_info.width
+            || output_info.height != input_info.height)
+        {
+            cout << "\n" << output_file << " exists and is not the same size as the input." << endl;
+            return {};
+        }
+        cout << "\nPatching existing " << output_file << endl;
+    }
+    existing.close();
+    
+    int x, y, width, height;
+    cout << "Enter left column and top row of the region: " << endl;
+    cin >> x >> y;
+    cout << "Enter width and height of the region: " << endl;
+    cin >> width >> height;
+    if (!input_info.valid || x < 0 || y < 0 || width <= 0 || height <= 0
+        || x > input_info.width - width || y > input_info.height - height)
+    {
+        cout << "\nRegion is not inside a valid image." << endl;
+        return {};
+    }
+    
+    int menu_number = 0;
+    cout << "Enter menu number of operation to apply (1-3, 7-10, 16): ";
+    cin >> menu_number;
+    if ((menu_number < 1 || menu_number > 10 || (menu_number >= 4 && menu_number <= 6)) && menu_number != 16)
+    {
+        // rotating or enlarging would not fit back into the same rectangle
+        cout << "\nOnly operations that keep the size can be applied to a region." << endl;
+        return {};
+    }
+    Operation_Params params = prompt_operation_params(menu_number);
+    
+    // read the rectangle plus the margin the window needs, cut at the image edges
+    int margin = 0;
+    if (menu_number == 16 || (menu_number == 7 && params.threshold_mode != GLOBAL_THRESHOLD))
+    {
+        margin = params.radius;
+    }
+    int top = max(0, y - margin);
+    int left = max(0, x - margin);
+    int bottom = min(input_info.height, y + height + margin);
+    int right = min(input_info.width, x + width + margin);
+    vector<vector<Pixel>> region = read_image_region(i_file, left, top, right - left, bottom - top);
+    if (region.empty())
+    {
+        cout << "\nCould not read the region from " << i_file << endl;
+        return {};
+    }
+    
+    vector<vector<Pixel>> new_region;
+    if (menu_number == 1)
+    {
+        new_region = apply_vignette_at(region, top, left, input_info.height, input_info.width);
+    }
+    else { new_region = apply_operation(region, params, num_threads); }
+    new_region = materialize_view(view_crop(make_view(new_region), y - top, x - left, height, width));
+    
+    // start the output as a copy of the input if it is not there yet
+    if (!output_exists)
+    {
+        ifstream source(i_file, ios::binary);
+        ofstream copy(output_file, ios::binary);
+        copy << source.rdbuf();
+    }
+    if (!write_image_region(output_file, new_region, x, y))
+    {
+        cout << "\nCould not write region to " << output_file << endl;
+        if (!output_exists) { remove(output_file.c_str()); }
+        return {};
+    }
+    cout << "\nSuccessfully processed region!" << endl;
+    
+    return new_region;
+}
+
+/** Helper function - check a BMP file before decoding it
+ * read_image trusts the sizes in the header, so a truncated file would
+ * decode as garbage; compare against the real length of the file too.
+ * @param - file name
+ * @param - pixel array layout (output)
+ * @return - True if the headers add up and the whole pixel array is there
+*/
+
+bool valid_bmp_file(string filename, Bmp_Info& info)
+{
+    fstream stream;
+    stream.open(filename, ios::in | ios::binary);
+    if (!stream.is_open()) { return false; }
+    
+    info = read_bmp_info(stream);
+    stream.clear();
+    stream.seekg(0, ios::end);
+    return info.valid && stream.tellg() >= info.file_size;
+}
+
+/**
+ * Reads a whole 24 or 32 bit BMP image with one band of rows per worker
+ * thread. Each thread sizes and decodes its own rows, so with the same
+ * number of threads the threaded kernels find every band on their own
+ * NUMA node.
+ * @param filename    BMP image filename
+ * @param num_threads number of worker threads
+ * @return the image in format P, Pixels by default (empty if not valid)
+ */
+template <typename P = Pixel>
+vector<vector<P>> read_image_banded(string filename, int num_threads)
+{
+    Bmp_Info info;
+    if (!valid_bmp_file(filename, info)) { return {}; }
+    
+    vector<vector<P>> image(info.height);
+    atomic<bool> complete(true);
+    run_in_parallel(num_threads, [&](int t)
+    {
+        int first_row, end_row;
+        row_band(t, num_threads, info.height, first_row, end_row);
+        allocate_band(image, first_row, end_row, info.width);
+        
+        fstream stream;
+        stream.open(filename, ios::in | ios::binary);
+        int bytes_per_pixel = info.bits_per_pixel / 8;
+        vector<unsigned char> bytes((size_t)info.width * bytes_per_pixel);
+        for (int i = first_row; i < end_row && stream; i++)
+        {
+            stream.seekg(pixel_offset(info, i, 0));
+            stream.read((char*)bytes.data(), bytes.size());
+            for (int j = 0; j < info.width; j++)
+            {
+                image[i][j] = Pixel_Format<P>::from_bgra(bytes[j * bytes_per_pixel], bytes[j * bytes_per_pixel + 1],
+                    bytes[j * bytes_per_pixel + 2], Pixel_Format<P>::max_value);
+            }
+        }
+        if (!stream) { complete.store(false); }
+    });
+    
+    if (!complete.load()) { return {}; }
+    return image;
+}
+
+//
+// FORMAT DISPATCH
+//
+// load_image keeps the image only in the pixel format of its file (8-bit
+// gray, 24, 32 or 48 bit), and the menu operations, previews and batch
+// jobs run and are written in that format, so single channel gray results,
+// alpha and 16-bit channels survive. The format is picked once, when the
+// image is loaded. The tools that only work on the 8-bit Pixel kernels
+// (sweep, transform, benchmarks) get a Pixel copy from loaded_pixels for
+// as long as they run.
+//
+
+/**
+ * An image in one pixel format, with its preview pyramid
+ */
+template <typename P>
+struct Format_Image
+{
+    vector<vector<P>> image;
+    vector<vector<vector<P>>> pyramid;  // 1/2, 1/4, 1/8 levels, built by the first preview
+};
+
+/**
+ * An image in the pixel format of the file it came from
+ */
+struct Loaded_Image
+{
+    int bits_per_pixel = 0;         // 8 (gray), 24, 32 or 48; 0 if not loaded
+    int width = 0;
+    int height = 0;
+    Format_Image<Gray8> gray8;
+    Format_Image<BGR24> bgr24;
+    Format_Image<BGRA32> bgra32;
+    Format_Image<BGR48> bgr48;
+};
+
+/** Helper function - check whether every pixel of an image is gray
+ * @param - image
+ * @return - True if red, green and blue are equal everywhere
+*/
+template <typename P>
+bool is_gray(const vector<vector<P>>& image)
+{
+    for (const vector<P>& row : image)
+    {
+        for (const P& pixel : row)
+        {
+            int blue, green, red, alpha;
+            Pixel_Format<P>::to_bgra(pixel, blue, green, red, alpha);
+            if (blue != green || green != red) { return false; }
+        }
+    }
+    return true;
+}
+
+/** Helper function - record a loaded image and its format
+ * @param - loaded image (output)
+ * @param - member of loaded for the format, holding the image
+ * @param - bits per pixel of the format
+ * @return - True if the image is not empty
+*/
+template <typename P>
+bool set_loaded(Loaded_Image& loaded, const Format_Image<P>& formatted, int bits_per_pixel)
+{
+    if (formatted.image.empty()) { return false; }
+    loaded.bits_per_pixel = bits_per_pixel;
+    loaded.height = formatted.image.size();
+    loaded.width = formatted.image[0].size();
+    return true;
+}
+
+/**
+ * Load a BMP image for the menu or a batch job
+ * @param filename    BMP image filename
+ * @param loaded      the image in its own pixel format (output)
+ * @param num_threads threads decoding 24-bit images (see read_image_banded)
+ * @return True if the image was loaded
+ */
+bool load_image(string filename, Loaded_Image& loaded, int num_threads)
+{
+    loaded = Loaded_Image();
+    fstream stream;
+    stream.open(filename, ios::in | ios::binary);
+    if (!stream.is_open()) { return false; }
+    int bits_per_pixel = get_int(stream, 28, 2);
+    stream.close();
+    
+    if (bits_per_pixel == 24)
+    {
+        loaded.bgr24.image = read_image_banded<BGR24>(filename, num_threads);
+        return set_loaded(loaded, loaded.bgr24, 24);
+    }
+    if (bits_per_pixel == 32)
+    {
+        loaded.bgra32.image = read_image_as<BGRA32>(filename);
+        return set_loaded(loaded, loaded.bgra32, 32);
+    }
+    if (bits_per_pixel == 48)
+    {
+        loaded.bgr48.image = read_image_as<BGR48>(filename);
+        return set_loaded(loaded, loaded.bgr48, 48);
+    }
+    if (bits_per_pixel == 8)
+    {
+        loaded.bgr24.image = read_image_as<BGR24>(filename);
+        if (!is_gray(loaded.bgr24.image)) { return set_loaded(loaded, loaded.bgr24, 24); }
+        loaded.gray8.image = convert_format<Gray8>(loaded.bgr24.image);
+        loaded.bgr24 = Format_Image<BGR24>();
+        return set_loaded(loaded, loaded.gray8, 8);
+    }
+    return false;
+}
+
+/** Helper function - copy a loaded image into Pixels for the tools that
+ * only have 8-bit Pixel kernels
+ * @param - loaded image
+ * @return - the image as Pixels (empty if nothing is loaded)
+*/
+vector<vector<Pixel>> loaded_pixels(const Loaded_Image& loaded)
+{
+    switch (loaded.bits_per_pixel)
+    {
+        case 8: return convert_format<Pixel>(loaded.gray8.image);
+        case 24: return convert_format<Pixel>(loaded.bgr24.image);
+        case 32: return convert_format<Pixel>(loaded.bgra32.image);
+        case 48: return convert_format<Pixel>(loaded.bgr48.image);
+    }
+    return {};
+}
+
+/** Helper function - apply an operation to an image of format P and write
+ * the result in that format (single channel for gray results, three
+ * channel for B/W/R/G/B of a gray image)
+ * Dithering, local thresholds and box blur run on the 8-bit Pixel kernels,
+ * with alpha copied back afterwards.
+ * @param - output file name
+ * @param - input image
+ * @param - operation and its parameters
+ * @param - number of threads
+ * @return - True if the file was written
+*/
+template <typename P>
+bool write_operation_as(string filename, const vector<vector<P>>& image, const Operation_Params& params,
+    int num_threads)
+{
+    typedef typename Pixel_Format<P>::gray_type G;
+    typedef typename Pixel_Format<P>::color_type C;
+    switch (params.menu_number)
+    {
+        case 1: return write_image_as(filename, apply_vignette_as(image, num_threads));
+        case 2: return write_image_as(filename, apply_clarendon_as(image, params.scaling_factor, num_threads));
+        case 3: return write_image_as(filename, apply_gray_scale_as(image, num_threads));
+        case 4:
+        case 5: return write_view(filename, view_rotate(make_view(image), params.num_rotations));
+        case 6:
+            if (params.x_scaling_factor < 1 || params.y_scaling_factor < 1) { return false; }
+            if (!enlarge_fits(make_view(image), params.x_scaling_factor, params.y_scaling_factor)) { return false; }
+            return write_view(filename, view_enlarge(make_view(image), params.x_scaling_factor, params.y_scaling_factor));
+        case 7:
+            if (params.threshold_mode == GLOBAL_THRESHOLD && params.dither_mode == NO_DITHER)
+            {
+                return write_image_as(filename, apply_high_contrast_as(image, num_threads));
+            }
+            return write_image_as(filename, convert_format<G>(apply_operation(convert_format<Pixel>(image), params, num_threads)));
+        case 8: return write_image_as(filename, apply_lighten_as(image, params.scaling_factor, num_threads));
+        case 9: return write_image_as(filename, apply_darken_as(image, params.scaling_factor, num_threads));
+        case 10:
+            if (params.dither_mode == NO_DITHER)
+            {
+                return write_image_as(filename, apply_bwrgb_as(image, num_threads));
+            }
+            else
+            {
+                vector<vector<C>> new_image = convert_format<C>(apply_operation(convert_format<Pixel>(image), params, num_threads));
+                keep_alpha(image, new_image);
+                return write_image_as(filename, new_image);
+            }
+        case 16:
+        {
+            vector<vector<P>> new_image = convert_format<P>(apply_operation(convert_format<Pixel>(image), params, num_threads));
+            keep_alpha(image, new_image);
+            return write_image_as(filename, new_image);
+        }
+    }
+    return false;
+}
+
+/** Helper function - apply an operation and write the result in the
+ * format the image was loaded in
+ * @param - output file name
+ * @param - the image in its own format
+ * @param - operation and its parameters
+ * @param - number of threads
+ * @return - True if the file was written
+*/
+bool write_operation_loaded(string filename, const Loaded_Image& loaded, const Operation_Params& params,
+    int num_threads)
+{
+    switch (loaded.bits_per_pixel)
+    {
+        case 8: return write_operation_as(filename, loaded.gray8.image, params, num_threads);
+        case 24: return write_operation_as(filename, loaded.bgr24.image, params, num_threads);
+        case 32: return write_operation_as(filename, loaded.bgra32.image, params, num_threads);
+        case 48: return write_operation_as(filename, loaded.bgr48.image, params, num_threads);
+    }
+    return false;
+}
+
+/** Run a menu operation (1-10, 16) on the loaded image, keeping its format
+ * @param - menu number
+ * @param - the image in its own format
+ * @param - input file name
+ * @param - number of threads
+*/
+void process_loaded_image(int menu_number, const Loaded_Image& loaded, string i_file, int num_threads)
+{
+    cout << "\nOperation " << menu_number << " selected (" << loaded.bits_per_pixel
+         << "-bit image, output keeps the format)\n" << endl;
+    string output_file = validate_file_name(i_file);
+    Operation_Params params = prompt_operation_params(menu_number);
+    if (menu_number == 6 && (params.x_scaling_factor < 1 || params.y_scaling_factor < 1))
+    {
+        cout << "\nScaling factors must be at least 1." << endl;
+        return;
+    }
+    
+    if (write_operation_loaded(output_file, loaded, params, num_threads))
+    {
+        cout << "\nSuccessfully processed image!" << endl;
+    }
+    else if (menu_number == 6)
+    {
+        cout << "\nCould not write " << output_file << " (a BMP file is limited to 4 GB)." << endl;
+    }
+    else { cout << "\nCould not write " << output_file << endl; }
+}
+
+/** Helper function - preview loop for an image of format P
+ * Previews and the full resolution save both go through
+ * write_operation_as, so they use the same kernels.
+ * @param - full resolution image, and its pyramid (built here if empty)
+ * @param - menu number of the operation
+ * @param - target size, in pixels along the longest side
+ * @param - input file name
+ * @param - number of threads
+*/
+template <typename P>
+void preview_operation_as(Format_Image<P>& formatted, int menu_number, int target_size, string i_file,
+    int num_threads)
+{
+    if (formatted.pyramid.empty()) { formatted.pyramid = build_pyramid(formatted.image); }
+    const vector<vector<P>>& level = select_pyramid_level(formatted.image, formatted.pyramid, target_size);
+    
+    // each pyramid level halves the image, so windows shrink with it
+    int level_scale = 1;
+    for (size_t k = 0; k < formatted.pyramid.size() && &level != &formatted.image; k++)
+    {
+        level_scale *= 2;
+        if (&formatted.pyramid[k] == &level) { break; }
+    }
+    string preview_file = i_file.substr(0, i_file.length() - 4) + "_preview.bmp";
+    
+    string answer = "r";
+    while (answer == "r" || answer == "R")
+    {
+        Operation_Params params = prompt_operation_params(menu_number);
+        Operation_Params level_params = params;
+        if (menu_number == 7 || menu_number == 16)
+        {
+            level_params.radius = (params.radius + level_scale / 2) / level_scale;
+            if (menu_number == 7) { level_params.radius = max(1, level_params.radius); }
+        }
+        
+        auto start = chrono::steady_clock::now();
+        if (!write_operation_as(preview_file, level, level_params, num_threads))
+        {
+            cout << "\nResult would be too large, or " << preview_file << " could not be written." << endl;
+            return;
+        }
+        auto stop = chrono::steady_clock::now();
+        
+        cout << "\nPreview (" << level[0].size() << "x" << level.size() << ") written to "
+             << preview_file << " in "
+             << chrono::duration<double, milli>(stop - start).count() << " ms" << endl;
+        
+        cout << "\nS) Save at full resolution  R) Retry with new parameters  C) Cancel: ";
+        cin >> answer;
+        if (answer == "s" || answer == "S")
+        {
+            string output_file = validate_file_name(i_file);
+            if (!write_operation_as(output_file, formatted.image, params, num_threads))
+            {
+                cout << "\nCould not write " << output_file << endl;
+                return;
+            }
+            cout << "\nSuccessfully saved full resolution image!" << endl;
+            return;
+        }
+    }
+}
+
+/** Process 11 - Preview an operation at reduced resolution
+ * Runs the operation on the smallest pyramid level that meets the target
+ * size and writes it to <input>_preview.bmp, so parameters can be tried
+ * quickly. Full resolution is only rendered when the user saves.
+ * @param - the image in its own format (its pyramid is kept for later previews)
+ * @param - input file name
+ * @param - number of threads
+ * @return - nothing
+*/
+
+void preview_operation(Loaded_Image& loaded, string i_file, int num_threads)
+{
+    cout << "\nPreview selected\n" << endl;
+    if (loaded.bits_per_pixel == 0)
+    {
+        cout << "Current image could not be read. Choose another image." << endl;
+        return;
+    }
+    
+    int menu_number = 0;
+    cout << "Enter menu number of operation to preview (1-10, 16): ";
+    cin >> menu_number;
+    if ((menu_number < 1 || menu_number > 10) && menu_number != 16)
+    {
+        cout << "\nNot a valid operation." << endl;
+        return;
+    }
+    
+    int target_size = 0;
+    cout << "Enter preview size (pixels along longest side): ";
+    cin >> target_size;
+    
+    switch (loaded.bits_per_pixel)
+    {
+        case 8: preview_operation_as(loaded.gray8, menu_number, target_size, i_file, num_threads); break;
+        case 24: preview_operation_as(loaded.bgr24, menu_number, target_size, i_file, num_threads); break;
+        case 32: preview_operation_as(loaded.bgra32, menu_number, target_size, i_file, num_threads); break;
+        case 48: preview_operation_as(loaded.bgr48, menu_number, target_size, i_file, num_threads); break;
+    }
+}
+
+/** Helper function - time a piece of work, best of a few runs
+ * @param - work to time
+ * @return - milliseconds for the fastest run
+*/
+template <typename F>
+double time_ms(F work)
+{
+    const int RUNS = 3;
+    double best = 0;
+    for (int run = 0; run < RUNS; run++)
+    {
+        auto start = chrono::steady_clock::now();
+        work();
+        auto stop = chrono::steady_clock::now();
+        double elapsed = chrono::duration<double, milli>(stop - start).count();
+        if (run == 0 || elapsed < best) { best = elapsed; }
+    }
+    return best;
+}
+
+/** Helper function - print one benchmark line
+ * @param - name of what was timed
+ * @param - milliseconds
+ * @param - pixels processed
+*/
+void print_benchmark(string name, double ms, double pixels)
+{
+    cout << "  " << name << ' ';
+    for (int k = name.length(); k < 38; k++) { cout << ' '; }
+    cout << ms << " ms\t" << pixels / (ms * 1000.0) << " MPix/s" << endl;
+}
+
+//
+// IMAGE BUFFERS
+//
+// vector<vector<Pixel>> gives every row its own heap block on ordinary
+// 4 KB pages. The menu's image and the threaded kernels' results get
+// first touch placement by sizing each band of rows on its worker thread
+// (read_image_banded, allocate_band). The memory settings (menu 18) can
+// put the loaded image on transparent huge pages and interleave it across
+// nodes after the fact, by advising the heap pages under its rows.
+// A Pixel_Buffer is one block for the whole image whose pages can be huge
+// pages (fewer TLB misses) and are either interleaved across nodes or
+// first touched by the worker thread that will process each band of rows.
+//
+
+enum Page_Policy { SMALL_PAGES, TRANSPARENT_HUGE_PAGES, EXPLICIT_HUGE_PAGES };
+enum Numa_Policy { FIRST_TOUCH, INTERLEAVE };
+
+/**
+ * Image stored in one block of memory, row after row
+ */
+struct Pixel_Buffer
+{
+    Pixel* pixels = nullptr;
+    size_t mapped_bytes = 0;
+    int num_rows = 0;
+    int num_cols = 0;
+    bool huge_pages = false;        // explicit huge pages were actually used
+    bool interleaved = false;       // pages were actually interleaved across nodes
+    
+    Pixel_Buffer() {}
+    Pixel_Buffer(const Pixel_Buffer&) = delete;
+    Pixel_Buffer& operator=(const Pixel_Buffer&) = delete;
+    ~Pixel_Buffer() { if (pixels) { munmap(pixels, mapped_bytes); } }
+    
+    Pixel* row(int i) { return pixels + (size_t)i * num_cols; }
+    const Pixel* row(int i) const { return pixels + (size_t)i * num_cols; }
+};
+
+/** Helper function - bit mask of the online NUMA nodes
+ * @return - mask (node 0 only if it cannot be read)
+*/
+
+unsigned long online_numa_nodes()
+{
+    // e.g. "0-1" or "0,2-3"
+    ifstream online("/sys/devices/system/node/online");
+    unsigned long mask = 0;
+    string range;
+    while (getline(online, range, ','))
+    {
+        int first = 0, last = 0;
+        char dash = 0;
+        istringstream parts(range);
+        parts >> first;
+        last = first;
+        if (parts >> dash >> last) {}
+        for (int node = first; node <= last && node < 64; node++) { mask |= 1ul << node; }
+    }
+    return mask ? mask : 1ul;
+}
+
+/** Allocate a Pixel_Buffer
+ * Pages are not touched here; with FIRST_TOUCH the caller should fill
+ * each band of rows from the thread that will process it.
+ * @param - buffer to allocate into
+ * @param - number of rows
+ * @param - number of columns
+ * @param - page size policy (explicit huge pages fall back to transparent
+ *          ones if none are reserved)
+ * @param - NUMA placement policy (interleaving falls back to first touch
+ *          if mbind is refused)
+ * @return - True if successful and false otherwise
+*/
+
+bool allocate_pixel_buffer(Pixel_Buffer& buffer, int num_rows, int num_cols, Page_Policy pages, Numa_Policy numa)
+{
+    const size_t HUGE_PAGE_BYTES = 2 * 1024 * 1024;
+    size_t bytes = (size_t)num_rows * num_cols * sizeof(Pixel);
+    if (pages != SMALL_PAGES)
+    {
+        bytes = (bytes + HUGE_PAGE_BYTES - 1) / HUGE_PAGE_BYTES * HUGE_PAGE_BYTES;
+    }
+    
+    void* memory = MAP_FAILED;
+    buffer.huge_pages = false;
+    buffer.interleaved = false;
+    if (pages == EXPLICIT_HUGE_PAGES)
+    {
+        memory = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        buffer.huge_pages = memory != MAP_FAILED;
+    }
+    if (memory == MAP_FAILED)
+    {
+        memory = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (memory == MAP_FAILED) { return false; }
+        if (pages != SMALL_PAGES) { madvise(memory, bytes, MADV_HUGEPAGE); }
+    }
+    
+    if (numa == INTERLEAVE)
+    {
+        // MPOL_INTERLEAVE, called directly so libnuma is not needed
+        const int MPOL_INTERLEAVE_MODE = 3;
+        unsigned long nodes = online_numa_nodes();
+        buffer.interleaved = syscall(SYS_mbind, memory, bytes, MPOL_INTERLEAVE_MODE, &nodes, sizeof(nodes) * 8, 0) == 0;
+    }
+    
+    if (buffer.pixels) { munmap(buffer.pixels, buffer.mapped_bytes); }
+    buffer.pixels = (Pixel*)memory;
+    buffer.mapped_bytes = bytes;
+    buffer.num_rows = num_rows;
+    buffer.num_cols = num_cols;
+    return true;
+}
+
+/**
+ * Reads the BMP image specified into a Pixel_Buffer
+ * Each worker thread opens the file and decodes its own band of rows, so
+ * with FIRST_TOUCH every band is placed on the node of the thread that
+ * decoded it. Process the buffer with the same number of threads to keep
+ * the bands local.
+ * @param filename    BMP image filename
+ * @param buffer      buffer to read into
+ * @param pages       page size policy
+ * @param numa        NUMA placement policy
+ * @param num_threads number of worker threads
+ * @return True if successful and false otherwise
+ */
+bool read_image_to_buffer(string filename, Pixel_Buffer& buffer, Page_Policy pages, Numa_Policy numa, int num_threads)
+{
+    fstream stream;
+    stream.open(filename, ios::in | ios::binary);
+    if (!stream.is_open()) { return false; }
+    Bmp_Info info = read_bmp_info(stream);
+    stream.close();
+    
+    if (!info.valid || !allocate_pixel_buffer(buffer, info.height, info.width, pages, numa))
+    {
+        return false;
+    }
+    
+    run_in_parallel(num_threads, [&](int t)
+    {
+        int first_row, end_row;
+        row_band(t, num_threads, info.height, first_row, end_row);
+        
+        fstream band_stream;
+        band_stream.open(filename, ios::in | ios::binary);
+        int bytes_per_pixel = info.bits_per_pixel / 8;
+        vector<unsigned char> bytes(info.width * bytes_per_pixel);
+        for (int i = first_row; i < end_row; i++)
+        {
+            band_stream.seekg(pixel_offset(info, i, 0));
+            band_stream.read((char*)bytes.data(), bytes.size());
+            Pixel* row = buffer.row(i);
+            for (int j = 0; j < info.width; j++)
+            {
+                row[j].blue = bytes[j * bytes_per_pixel];
+                row[j].green = bytes[j * bytes_per_pixel + 1];
+                row[j].red = bytes[j * bytes_per_pixel + 2];
+            }
+        }
+    });
+    return true;
+}
+
+/** Lighten kernel for Pixel_Buffers, one band of rows per thread
+ * @param - input buffer
+ * @param - output buffer, same size (allocated, may be untouched)
+ * @param - scaling factor
+ * @param - number of worker threads
+*/
+
+void apply_lighten_buffer(const Pixel_Buffer& image, Pixel_Buffer& new_image, double scaling_factor, int num_threads)
+{
+    run_in_parallel(num_threads, [&](int t)
+    {
+        int first_row, end_row;
+        row_band(t, num_threads, image.num_rows, first_row, end_row);
+        for (int i = first_row; i < end_row; i++)
+        {
+            const Pixel* row = image.row(i);
+            Pixel* new_row = new_image.row(i);
+            for (int j = 0; j < image.num_cols; j++)
+            {
+                new_row[j].red = (255 - (255 - row[j].red) * scaling_factor);
+                new_row[j].green = (255 - (255 - row[j].green) * scaling_factor);
+                new_row[j].blue = (255 - (255 - row[j].blue) * scaling_factor);
+            }
+        }
+    });
+}
+
+/** Lighten kernel for vectors of rows, one band of rows per thread
+ * Each thread sizes its own output rows. Same results as apply_lighten.
+ * @param - input image
+ * @param - scaling factor
+ * @param - number of worker threads
+ * @return - output image
+*/
+
+vector<vector<Pixel>> apply_lighten_banded(const vector<vector<Pixel>>& image, double scaling_factor, int num_threads)
+{
+    int num_rows = image.size(); 
+    int num_cols = image[0].size(); 
+    vector<vector<Pixel>> new_image(num_rows); 
+    run_in_parallel(num_threads, [&](int t)
+    {
+        int first_row, end_row;
+        row_band(t, num_threads, num_rows, first_row, end_row);
+        allocate_band(new_image, first_row, end_row, num_cols);
+        for (int i = first_row; i < end_row; i++)
+        {
+            for (int j = 0; j < num_cols; j++)
+            {
+                new_image[i][j].red = (255 - (255 - image[i][j].red) * scaling_factor);
+                new_image[i][j].green = (255 - (255 - image[i][j].green) * scaling_factor);
+                new_image[i][j].blue = (255 - (255 - image[i][j].blue) * scaling_factor);
+            }
+        }
+    });
+    return new_image;
+}
+
+/**
+ * Memory policy for the loaded image, chosen from the menu
+ */
+struct Memory_Settings
+{
+    Page_Policy pages = SMALL_PAGES;    // SMALL_PAGES (no advice) or TRANSPARENT_HUGE_PAGES
+    Numa_Policy numa = FIRST_TOUCH;
+};
+
+/**
+ * What apply_memory_settings managed to do
+ */
+struct Memory_Report
+{
+    size_t bytes = 0;               // bytes of pages under the image's rows
+    size_t huge_bytes = 0;          // of those, collapsed into huge pages
+    bool interleaved = false;       // every span was interleaved across nodes
+};
+
+/** Helper function - set the NUMA policy of the calling thread
+ * Threads started afterwards (run_in_parallel, batch workers) inherit it,
+ * so with INTERLEAVE every image allocated from then on is interleaved
+ * as it is first touched.
+ * @param - FIRST_TOUCH (the default policy) or INTERLEAVE
+ * @return - True if the policy was set
+*/
+
+bool set_numa_policy(Numa_Policy numa)
+{
+    // set_mempolicy, called directly so libnuma is not needed
+    const int MPOL_DEFAULT_MODE = 0;
+    const int MPOL_INTERLEAVE_MODE = 3;
+    if (numa == INTERLEAVE)
+    {
+        unsigned long nodes = online_numa_nodes();
+        return syscall(SYS_set_mempolicy, MPOL_INTERLEAVE_MODE, &nodes, sizeof(nodes) * 8) == 0;
+    }
+    return syscall(SYS_set_mempolicy, MPOL_DEFAULT_MODE, nullptr, 0) == 0;
+}
+
+/** Helper function - the address ranges under an image's rows
+ * Rows are separate heap blocks, but rows allocated one after another sit
+ * next to each other, so they merge into a few page aligned spans.
+ * @param - image
+ * @return - [first, end) spans, sorted
+*/
+
+template <typename P>
+vector<pair<uintptr_t, uintptr_t>> row_spans(const vector<vector<P>>& image)
+{
+    const uintptr_t PAGE_BYTES = sysconf(_SC_PAGESIZE);
+    vector<pair<uintptr_t, uintptr_t>> rows;
+    for (const vector<P>& row : image)
+    {
+        if (row.empty()) { continue; }
+        uintptr_t first = (uintptr_t)row.data() / PAGE_BYTES * PAGE_BYTES;
+        uintptr_t end = ((uintptr_t)(row.data() + row.size()) + PAGE_BYTES - 1) / PAGE_BYTES * PAGE_BYTES;
+        rows.push_back({ first, end });
+    }
+    sort(rows.begin(), rows.end());
+    
+    vector<pair<uintptr_t, uintptr_t>> spans;
+    for (const pair<uintptr_t, uintptr_t>& row : rows)
+    {
+        if (!spans.empty() && row.first <= spans.back().second)
+        {
+            spans.back().second = max(spans.back().second, row.second);
+        }
+        else { spans.push_back(row); }
+    }
+    return spans;
+}
+
+/** Apply the memory settings to an image that is already in memory
+ * Interleaving moves its pages across the nodes (mbind with MPOL_MF_MOVE);
+ * huge pages mark the whole 2 MB pages under its rows for THP and collapse
+ * them now rather than waiting for khugepaged. Explicit huge pages cannot
+ * back heap rows, they stay with Pixel_Buffer. Neighbouring heap data on
+ * the same pages gets the same treatment.
+ * @param - image
+ * @param - settings
+ * @return - what was applied
+*/
+
+template <typename P>
+Memory_Report apply_memory_settings(const vector<vector<P>>& image, const Memory_Settings& settings)
+{
+    const uintptr_t HUGE_PAGE_BYTES = 2 * 1024 * 1024;
+    const int MADV_COLLAPSE_ADVICE = 25;        // Linux 6.1 and later
+    const int MPOL_INTERLEAVE_MODE = 3;
+    const unsigned MPOL_MF_MOVE_FLAG = 1 << 1;
+    
+    Memory_Report report;
+    vector<pair<uintptr_t, uintptr_t>> spans = row_spans(image);
+    report.interleaved = settings.numa == INTERLEAVE && !spans.empty();
+    for (const pair<uintptr_t, uintptr_t>& span : spans)
+    {
+        report.bytes += span.second - span.first;
+        if (settings.numa == INTERLEAVE)
+        {
+            unsigned long nodes = online_numa_nodes();
+            report.interleaved &= syscall(SYS_mbind, span.first, span.second - span.first, MPOL_INTERLEAVE_MODE,
+                &nodes, sizeof(nodes) * 8, MPOL_MF_MOVE_FLAG) == 0;
+        }
+        
+        // only whole huge pages inside the span
+        uintptr_t first = (span.first + HUGE_PAGE_BYTES - 1) / HUGE_PAGE_BYTES * HUGE_PAGE_BYTES;
+        uintptr_t end = span.second / HUGE_PAGE_BYTES * HUGE_PAGE_BYTES;
+        if (settings.pages != SMALL_PAGES && end > first)
+        {
+            madvise((void*)first, end - first, MADV_HUGEPAGE);
+            if (madvise((void*)first, end - first, MADV_COLLAPSE_ADVICE) == 0) { report.huge_bytes += end - first; }
+        }
+    }
+    return report;
+}
+
+/** Apply the memory settings to the loaded image, in whatever format it is
+ * @param - loaded image
+ * @param - settings
+ * @return - what was applied
+*/
+
+Memory_Report apply_memory_settings(const Loaded_Image& loaded, const Memory_Settings& settings)
+{
+    switch (loaded.bits_per_pixel)
+    {
+        case 8: return apply_memory_settings(loaded.gray8.image, settings);
+        case 24: return apply_memory_settings(loaded.bgr24.image, settings);
+        case 32: return apply_memory_settings(loaded.bgra32.image, settings);
+        case 48: return apply_memory_settings(loaded.bgr48.image, settings);
+    }
+    return Memory_Report();
+}
+
+/** Helper function - print what apply_memory_settings did
+ * @param - report
+ * @param - settings that were asked for
+*/
+
+void print_memory_report(const Memory_Report& report, const Memory_Settings& settings)
+{
+    cout << "\nImage memory: " << report.bytes / 1024 << " KB";
+    if (settings.pages != SMALL_PAGES)
+    {
+        cout << ", " << report.huge_bytes / 1024 << " KB on huge pages";
+        if (report.huge_bytes == 0) { cout << " (rows too small or THP not available)"; }
+    }
+    if (settings.numa == INTERLEAVE)
+    {
+        cout << (report.interleaved ? ", interleaved across nodes" : ", not interleaved (mbind refused)");
+    }
+    cout << endl;
+}
+
+/** Process 18 - Memory settings
+ * Chooses huge pages and NUMA interleaving for the loaded image and for
+ * the images loaded after it. Interleaving also covers the kernels'
+ * results, which otherwise are placed by first touch.
+ * @param - settings (updated)
+ * @return - True if the settings changed
+*/
+
+bool memory_settings_menu(Memory_Settings& settings)
+{
+    cout << "\nMemory settings selected\n" << endl;
+    cout << "Current: " << (settings.pages == SMALL_PAGES ? "default pages" : "transparent huge pages") << ", "
+         << (settings.numa == FIRST_TOUCH ? "first touch" : "interleaved") << endl;
+    
+    int pages = -1;
+    while (pages != 0 && pages != 1)
+    {
+        cout << "Pages - 0) Default  1) Transparent huge pages: ";
+        cin >> pages;
+        if (cin.fail()) { cin.clear(); cin.ignore(1000, '\n'); pages = -1; }
+    }
+    int numa = -1;
+    while (numa != 0 && numa != 1)
+    {
+        cout << "NUMA placement - 0) First touch  1) Interleave across nodes: ";
+        cin >> numa;
+        if (cin.fail()) { cin.clear(); cin.ignore(1000, '\n'); numa = -1; }
+    }
+    
+    Memory_Settings chosen;
+    chosen.pages = pages == 1 ? TRANSPARENT_HUGE_PAGES : SMALL_PAGES;
+    chosen.numa = numa == 1 ? INTERLEAVE : FIRST_TOUCH;
+    bool changed = chosen.pages != settings.pages || chosen.numa != settings.numa;
+    settings = chosen;
+    if (!set_numa_policy(settings.numa)) { cout << "\n(set_mempolicy refused, new images placed by first touch)" << endl; }
+    return changed;
+}
+
+/**
+ * Page fault and data TLB miss counts for a stretch of work. Faults come
+ * from getrusage; TLB misses from perf_event_open, which may not be
+ * allowed (tlb_available is false then).
+ */
+struct Memory_Counters
+{
+    long minor_faults = 0;
+    long major_faults = 0;
+    long long tlb_misses = 0;
+    bool tlb_available = false;
+    int perf_fd = -1;
+};
+
+/** Helper function - start counting page faults and TLB misses
+ * Threads created after this call are included in the TLB count.
+ * @param - counters to start
+*/
+
+void start_counters(Memory_Counters& counters)
+{
+    perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HW_CACHE;
+    attr.config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    attr.disabled = 1;
+    attr.inherit = 1;
+    attr.exclude_kernel = 1;
+    counters.perf_fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    if (counters.perf_fd >= 0)
+    {
+        ioctl(counters.perf_fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(counters.perf_fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+    
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    counters.minor_faults = usage.ru_minflt;
+    counters.major_faults = usage.ru_majflt;
+}
+
+/** Helper function - stop counting, leaving the totals in counters
+ * @param - counters to stop
+*/
+
+void stop_counters(Memory_Counters& counters)
+{
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    counters.minor_faults = usage.ru_minflt - counters.minor_faults;
+    counters.major_faults = usage.ru_majflt - counters.major_faults;
+    
+    counters.tlb_available = false;
+    if (counters.perf_fd >= 0)
+    {
+        ioctl(counters.perf_fd, PERF_EVENT_IOC_DISABLE, 0);
+        long long count = 0;
+        counters.tlb_available = read(counters.perf_fd, &count, sizeof(count)) == sizeof(count);
+        counters.tlb_misses = count;
+        close(counters.perf_fd);
+        counters.perf_fd = -1;
+    }
+}
+
+/** Helper function - print page fault and TLB counts after a benchmark line
+ * @param - counters
+*/
+
+void print_counters(const Memory_Counters& counters)
+{
+    cout << "\t\tfaults " << counters.minor_faults << " minor, " << counters.major_faults << " major, dTLB misses ";
+    if (counters.tlb_available) { cout << counters.tlb_misses << endl; }
+    else { cout << "n/a" << endl; }
+}
+
+/** Helper function - benchmark one buffer policy: parallel decode into
+ * the buffer, then a parallel lighten pass into a second buffer
+ * @param - policy name for the report
+ * @param - input file name
+ * @param - page size policy
+ * @param - NUMA placement policy
+ * @param - number of worker threads
+*/
+
+void benchmark_buffer_policy(string name, string i_file, Page_Policy pages, Numa_Policy numa, int num_threads)
+{
+    Pixel_Buffer image;
+    Pixel_Buffer new_image;
+    Memory_Counters counters;
+    
+    start_counters(counters);
+    auto start = chrono::steady_clock::now();
+    bool read = read_image_to_buffer(i_file, image, pages, numa, num_threads);
+    double read_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    stop_counters(counters);
+    if (!read)
+    {
+        cout << "  " << name << ": could not read image" << endl;
+        return;
+    }
+    
+    double pixels = (double)image.num_rows * image.num_cols;
+    print_benchmark(name + " read", read_ms, pixels);
+    print_counters(counters);
+    
+    // first pass touches the output pages, second pass runs on warm pages
+    allocate_pixel_buffer(new_image, image.num_rows, image.num_cols, pages, numa);
+    start_counters(counters);
+    start = chrono::steady_clock::now();
+    apply_lighten_buffer(image, new_image, 0.5, num_threads);
+    double first_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    stop_counters(counters);
+    print_benchmark(name + " lighten (cold)", first_ms, pixels);
+    print_counters(counters);
+    
+    start_counters(counters);
+    start = chrono::steady_clock::now();
+    apply_lighten_buffer(image, new_image, 0.5, num_threads);
+    double second_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    stop_counters(counters);
+    print_benchmark(name + " lighten (warm)", second_ms, pixels);
+    print_counters(counters);
+    
+    if (pages == EXPLICIT_HUGE_PAGES && !image.huge_pages)
+    {
+        cout << "\t\t(no explicit huge pages reserved, used transparent huge pages)" << endl;
+    }
+    if (numa == INTERLEAVE && !image.interleaved)
+    {
+        cout << "\t\t(mbind refused, pages placed by first touch)" << endl;
+    }
+}
+
+/** Helper function - benchmark read, write and the filters for format P
+ * Gray scale is chained into high contrast to show the single channel
+ * result staying single channel.
+ * @param - format name for the report
+ * @param - input image
+ * @param - scratch file used for the read/write timings
+ * @param - number of threads for the filters
+*/
+template <typename P>
+void benchmark_format(string name, const vector<vector<Pixel>>& image, string scratch_file, int num_threads)
+{
+    double pixels = (double)image.size() * image[0].size();
+    vector<vector<P>> formatted = convert_format<P>(image);
+    typedef typename Pixel_Format<P>::gray_type G;
+    
+    cout << "\n" << name << " (" << sizeof(P) << " bytes/pixel, gray result "
+         << sizeof(G) << " bytes/pixel)" << endl;
+    print_benchmark("write_image_as", time_ms([&]() { write_image_as(scratch_file, formatted); }), pixels);
+    print_benchmark("read_image_as", time_ms([&]() { formatted = read_image_as<P>(scratch_file); }), pixels);
+    print_benchmark("gray scale, 1 thread", time_ms([&]() { apply_gray_scale_as(formatted, 1); }), pixels);
+    print_benchmark("gray scale", time_ms([&]() { apply_gray_scale_as(formatted, num_threads); }), pixels);
+    print_benchmark("gray scale -> high contrast", time_ms([&]() { apply_high_contrast_as(apply_gray_scale_as(formatted, num_threads), num_threads); }), pixels);
+    print_benchmark("lighten, 1 thread", time_ms([&]() { apply_lighten_as(formatted, 0.5, 1); }), pixels);
+    print_benchmark("lighten", time_ms([&]() { apply_lighten_as(formatted, 0.5, num_threads); }), pixels);
+    print_benchmark("darken", time_ms([&]() { apply_darken_as(formatted, 0.5, num_threads); }), pixels);
+    print_benchmark("vignette", time_ms([&]() { apply_vignette_as(formatted, num_threads); }), pixels);
+    print_benchmark("clarendon", time_ms([&]() { apply_clarendon_as(formatted, 0.5, num_threads); }), pixels);
+    print_benchmark("bwrgb", time_ms([&]() { apply_bwrgb_as(formatted, num_threads); }), pixels);
+}
+
+/** Process 12 - Benchmarks
+ * Times the filters on the current image and prints the results
+ * @param - input image
+ * @param - input file name (scratch files are named after it)
+*/
+void run_benchmarks(const vector<vector<Pixel>>& image, string i_file)
+{
+    cout << "\nBenchmarks selected\n" << endl;
+    if (image.empty())
+    {
+        cout << "Current image could not be read. Choose another image." << endl;
+        return;
+    }
+    
+    double pixels = (double)image.size() * image[0].size();
+    string scratch_file = i_file.substr(0, i_file.length() - 4) + "_bench.bmp";
+    int num_threads = max(1u, thread::hardware_concurrency());
+    cout << "Image: " << image[0].size() << "x" << image.size() << ", " << num_threads << " threads" << endl;
+    
+    // Pixel is read and written a row at a time too, so only the format differs
+    int width = image[0].size();
+    int height = image.size();
+    cout << "\nPixel (" << sizeof(Pixel) << " bytes/pixel)" << endl;
+    print_benchmark("write_view", time_ms([&]() { write_view(scratch_file, make_view(image)); }), pixels);
+    print_benchmark("read_image_region", time_ms([&]() { read_image_region(scratch_file, 0, 0, width, height); }), pixels);
+    print_benchmark("gray scale", time_ms([&]() { apply_gray_scale(image); }), pixels);
+    print_benchmark("gray scale -> high contrast", time_ms([&]() { apply_high_contrast(apply_gray_scale(image)); }), pixels);
+    print_benchmark("lighten", time_ms([&]() { apply_lighten(image, 0.5); }), pixels);
+    print_benchmark("darken", time_ms([&]() { apply_darken(image, 0.5); }), pixels);
+    print_benchmark("vignette", time_ms([&]() { apply_vignette(image); }), pixels);
+    print_benchmark("clarendon", time_ms([&]() { apply_clarendon(image, 0.5); }), pixels);
+    print_benchmark("bwrgb", time_ms([&]() { apply_bwrgb(image); }), pixels);
+    
+    benchmark_format<Gray8>("Gray8", image, scratch_file, num_threads);
+    benchmark_format<BGR24>("BGR24", image, scratch_file, num_threads);
+    benchmark_format<BGRA32>("BGRA32", image, scratch_file, num_threads);
+    benchmark_format<Gray16>("Gray16", image, scratch_file, num_threads);
+    benchmark_format<BGR48>("BGR48", image, scratch_file, num_threads);
+    
+    // image buffers, decoded and processed by the same worker threads
+    Memory_Counters counters;
+    write_image(scratch_file, image);
+    cout << "\nImage buffers (" << num_threads << " threads)" << endl;
+    start_counters(counters);
+    auto start = chrono::steady_clock::now();
+    vector<vector<Pixel>> rows = read_image_banded(scratch_file, num_threads);
+    print_benchmark("vector of rows read", chrono::duration<double, milli>(chrono::steady_clock::now() - start).count(), pixels);
+    stop_counters(counters);
+    print_counters(counters);
+    start_counters(counters);
+    start = chrono::steady_clock::now();
+    apply_lighten_banded(rows, 0.5, num_threads);
+    print_benchmark("vector of rows lighten", chrono::duration<double, milli>(chrono::steady_clock::now() - start).count(), pixels);
+    stop_counters(counters);
+    print_counters(counters);
+    benchmark_buffer_policy("4K pages, first touch", scratch_file, SMALL_PAGES, FIRST_TOUCH, num_threads);
+    benchmark_buffer_policy("THP, first touch", scratch_file, TRANSPARENT_HUGE_PAGES, FIRST_TOUCH, num_threads);
+    benchmark_buffer_policy("THP, interleaved", scratch_file, TRANSPARENT_HUGE_PAGES, INTERLEAVE, num_threads);
+    benchmark_buffer_policy("hugetlb, first touch", scratch_file, EXPLICIT_HUGE_PAGES, FIRST_TOUCH, num_threads);
+    
+    // dithering against plain thresholding
+    cout << "\nDithering (" << num_threads << " threads)" << endl;
+    print_benchmark("high contrast threshold", time_ms([&]() { apply_high_contrast(image); }), pixels);
+    print_benchmark("high contrast ordered", time_ms([&]() { ordered_high_contrast(image, num_threads); }), pixels);
+    print_benchmark("high contrast Floyd-Steinberg, 1 thread", time_ms([&]() { error_diffuse<Floyd_Steinberg_Kernel, High_Contrast_Quantizer>(image, 1); }), pixels);
+    print_benchmark("high contrast Floyd-Steinberg", time_ms([&]() { error_diffuse<Floyd_Steinberg_Kernel, High_Contrast_Quantizer>(image, num_threads); }), pixels);
+    print_benchmark("high contrast Atkinson", time_ms([&]() { error_diffuse<Atkinson_Kernel, High_Contrast_Quantizer>(image, num_threads); }), pixels);
+    print_benchmark("bwrgb threshold", time_ms([&]() { apply_bwrgb(image); }), pixels);
+    print_benchmark("bwrgb ordered", time_ms([&]() { ordered_bwrgb(image, num_threads); }), pixels);
+    print_benchmark("bwrgb Floyd-Steinberg, 1 thread", time_ms([&]() { error_diffuse<Floyd_Steinberg_Kernel, Bwrgb_Quantizer>(image, 1); }), pixels);
+    print_benchmark("bwrgb Floyd-Steinberg", time_ms([&]() { error_diffuse<Floyd_Steinberg_Kernel, Bwrgb_Quantizer>(image, num_threads); }), pixels);
+    print_benchmark("bwrgb Atkinson", time_ms([&]() { error_diffuse<Atkinson_Kernel, Bwrgb_Quantizer>(image, num_threads); }), pixels);
+    
+    // summed-area table filters, the cost should not grow with the window
+    cout << "\nSummed-area tables (" << num_threads << " threads)" << endl;
+    print_benchmark("build table", time_ms([&]() { build_summed_area_table(image.size(), image[0].size(),
+        [&](int i, int j) { return image[i][j].red; }, num_threads); }), pixels);
+    for (int radius : {1, 8, 64})
+    {
+        print_benchmark("box blur radius " + to_string(radius), time_ms([&]() { apply_box_blur(image, radius, num_threads); }), pixels);
+    }
+    for (int radius : {8, 64})
+    {
+        print_benchmark("Bradley radius " + to_string(radius), time_ms([&]() { apply_local_threshold(image, BRADLEY_THRESHOLD, radius, num_threads); }), pixels);
+        print_benchmark("Sauvola radius " + to_string(radius), time_ms([&]() { apply_local_threshold(image, SAUVOLA_THRESHOLD, radius, num_threads); }), pixels);
+    }
+    
+    remove(scratch_file.c_str());
+}
+
 /**
- * Process 1 - Add vignette
- * @param input img, vector of pixels
- * @param output file name
- * @return new image file with vignette applied
+ * One output of a parameter sweep. Rows are computed into one band
+ * buffer while the other band is being written by a writer thread.
+ */
+struct Sweep_Variant
+{
+    Operation_Params params;
+    string output_file;
+    fstream stream;
+    int x_scaling_factor = 1;       // 1 unless enlarging
+    int y_scaling_factor = 1;
+    int row_bytes = 0;              // bytes per output row including padding
+    vector<unsigned char> band[2];
+    thread writer;
+    double compute_ms = 0;
+    double write_ms = 0;
+    bool written = false;           // every byte reached the file
+};
+
+/** Helper function - name an output file after the variant's parameters
+ * @param - input file name
+ * @param - operation and its parameters
+ * @return - e.g. photo_lighten_0.5.bmp or photo_enlarge_3x2.bmp
+*/
+
+string sweep_file_name(string i_file, const Operation_Params& params)
+{
+    ostringstream name;
+    name << i_file.substr(0, i_file.length() - 4);
+    if (params.menu_number == 2) { name << "_clarendon_" << params.scaling_factor; }
+    else if (params.menu_number == 6) { name << "_enlarge_" << params.x_scaling_factor << "x" << params.y_scaling_factor; }
+    else if (params.menu_number == 8) { name << "_lighten_" << params.scaling_factor; }
+    else { name << "_darken_" << params.scaling_factor; }
+    name << ".bmp";
+    return name.str();
+}
+
+/** Helper function - compute one output row of a sweep variant
+ * Uses the same arithmetic as the apply_* kernels and write_image, so a
+ * sweep output is byte for byte the same as running the menu operation.
+ * @param - variant
+ * @param - source row, split into channels (shared by all variants)
+ * @param - average of R,G,B for each pixel (shared by all variants)
+ * @param - output bytes for the row
 */
-vector<vector<Pixel>> add_vignette(const vector<vector<Pixel>>& image, string i_file)
+
+void sweep_row(const Sweep_Variant& variant, const vector<int>& red, const vector<int>& green,
+    const vector<int>& blue, const vector<double>& average, unsigned char* out)
 {
-    cout << "\nVignette selected\n" << endl;
-    string output_file = validate_file_name(i_file); 
+    int num_cols = red.size();
+    double scaling_factor = variant.params.scaling_factor;
     
-    int num_rows = image.size(); 
-    int num_cols = image[0].size(); 
-    vector<vector<Pixel>> new_image(num_rows, vector<Pixel>(num_cols)); 
-    for (int i = 0; i < num_rows; i++)
+    if (variant.params.menu_number == 8)
     {
         for (int j = 0; j < num_cols; j++)
         {
-            // get original pixel color values
-            int red_value = image[i][j].red;
-            int green_value = image[i][j].green;
-            int blue_value = image[i][j].blue;
-            
-            // find distance to the center
-            double distance = sqrt(pow((j - num_cols/2.0), 2) + pow((i - num_rows/2.0), 2));
-            double scaling_factor = (num_rows - distance) / num_rows;
-            
-            // set pixel values for new image
-            new_image[i][j].red = red_value * scaling_factor;
-            new_image[i][j].green = green_value * scaling_factor;
-            new_image[i][j].blue = blue_value * scaling_factor;
+            out[3*j] = (int)(255 - (255 - blue[j]) * scaling_factor);
+            out[3*j + 1] = (int)(255 - (255 - green[j]) * scaling_factor);
+            out[3*j + 2] = (int)(255 - (255 - red[j]) * scaling_factor);
+        }
+    }
+    else if (variant.params.menu_number == 9)
+    {
+        for (int j = 0; j < num_cols; j++)
+        {
+            out[3*j] = (int)(blue[j] * scaling_factor);
+            out[3*j + 1] = (int)(green[j] * scaling_factor);
+            out[3*j + 2] = (int)(red[j] * scaling_factor);
+        }
+    }
+    else if (variant.params.menu_number == 2)
+    {
+        for (int j = 0; j < num_cols; j++)
+        {
+            if (average[j] >= 170)
+            {
+                out[3*j] = (int)(255 - (255 - blue[j]) * scaling_factor);
+                out[3*j + 1] = (int)(255 - (255 - green[j]) * scaling_factor);
+                out[3*j + 2] = (int)(255 - (255 - red[j]) * scaling_factor);
+            }
+            else if (average[j] < 90)
+            {
+                out[3*j] = (int)(blue[j] * scaling_factor);
+                out[3*j + 1] = (int)(green[j] * scaling_factor);
+                out[3*j + 2] = (int)(red[j] * scaling_factor);
+            }
+            else
+            {
+                out[3*j] = blue[j];
+                out[3*j + 1] = green[j];
+                out[3*j + 2] = red[j];
+            }
+        }
+    }
+    else
+    {
+        // enlarge - repeat each pixel, then repeat the whole row
+        int x_scaling_factor = variant.x_scaling_factor;
+        unsigned char* pixel = out;
+        for (int j = 0; j < num_cols; j++)
+        {
+            for (int k = 0; k < x_scaling_factor; k++)
+            {
+                pixel[0] = blue[j];
+                pixel[1] = green[j];
+                pixel[2] = red[j];
+                pixel += 3;
+            }
+        }
+        for (int k = 1; k < variant.y_scaling_factor; k++)
+        {
+            copy(out, out + variant.row_bytes, out + k * variant.row_bytes);
         }
     }
-    write_image(output_file, new_image);
-    cout << "\nSuccessfully added vignette!" << endl;
-    
-    
-    return new_image;
 }
 
-/**
-  * Process 2 - Clarendon effect - lights lighter/darks darker
-  * @param input image file
-  * @param output file name
-  * @return new image file
+/** Process 14 - Parameter sweep
+ * Renders many variants of clarendon, lighten, darken and enlarge in one
+ * pass over the current image. Each source row is loaded (and its average
+ * computed) once for all variants. Output is produced in bands of rows,
+ * and each variant's band is written by its own thread while the next
+ * band is computed.
+ * @param - input image
+ * @param - input file name (outputs are named after it)
 */
-vector<vector<Pixel>> add_clarendon(const vector<vector<Pixel>>& image, string i_file)
+
+void parameter_sweep(const vector<vector<Pixel>>& image, string i_file)
 {
-    cout << "\nAdd Clarendon selected\n" << endl;
-    string output_file = validate_file_name(i_file); 
+    cout << "\nParameter sweep selected\n" << endl;
+    if (image.empty())
+    {
+        cout << "Current image could not be read. Choose another image." << endl;
+        return;
+    }
     
-    // get scaling factor
-    cout << "Enter a scaling factor: ";
-    double scaling_factor;
-    cin >> scaling_factor; 
+    // collect the variants
+    vector<Operation_Params> all_params;
+    int menu_number = -1;
+    while (menu_number != 0)
+    {
+        cout << "Enter operation to sweep (2, 6, 8 or 9), or 0 to start: ";
+        cin >> menu_number;
+        if (menu_number == 2 || menu_number == 6 || menu_number == 8 || menu_number == 9)
+        {
+            int num_values = 0;
+            cout << "How many values? ";
+            cin >> num_values;
+            for (int k = 0; k < num_values; k++)
+            {
+                Operation_Params params = prompt_operation_params(menu_number);
+                if (menu_number == 6 && (params.x_scaling_factor < 1 || params.y_scaling_factor < 1))
+                {
+                    cout << "Enlarge factors must be at least 1, skipped." << endl;
+                    continue;
+                }
+                all_params.push_back(params);
+            }
+        }
+        else if (menu_number != 0) { cout << "Only 2, 6, 8 or 9 can be swept." << endl; }
+    }
+    if (all_params.empty()) { return; }
     
     int num_rows = image.size(); 
     int num_cols = image[0].size(); 
+    const int BAND_ROWS = 64;
     
-    // var to store new img
-    vector<vector<Pixel>> new_image(num_rows, vector<Pixel>(num_cols)); 
+    // open every output and write its header
+    vector<Sweep_Variant> variants(all_params.size());
+    for (size_t v = 0; v < variants.size(); v++)
+    {
+        Sweep_Variant& variant = variants[v];
+        variant.params = all_params[v];
+        variant.output_file = sweep_file_name(i_file, variant.params);
+        
+        // values that print the same (0.5 and 0.5000001) must not share a file
+        string stem = variant.output_file.substr(0, variant.output_file.length() - 4);
+        for (int copy = 2; any_of(variants.begin(), variants.begin() + v,
+            [&](const Sweep_Variant& other) { return other.output_file == variant.output_file; }); copy++)
+        {
+            variant.output_file = stem + "_" + to_string(copy) + ".bmp";
+        }
+        if (variant.params.menu_number == 6)
+        {
+            variant.x_scaling_factor = variant.params.x_scaling_factor;
+            variant.y_scaling_factor = variant.params.y_scaling_factor;
+        }
+        variant.stream.open(variant.output_file, ios::out | ios::binary);
+        if (!variant.stream.is_open())
+        {
+            cout << "Could not open " << variant.output_file << endl;
+            return;
+        }
+        variant.row_bytes = write_bmp_header(variant.stream, (long long)num_cols * variant.x_scaling_factor,
+            (long long)num_rows * variant.y_scaling_factor, 24, 0);
+        if (variant.row_bytes < 0)
+        {
+            cout << variant.output_file << " would be too large for a BMP file." << endl;
+            for (size_t k = 0; k <= v; k++)
+            {
+                variants[k].stream.close();
+                remove(variants[k].output_file.c_str());
+            }
+            return;
+        }
+        for (int b = 0; b < 2; b++)
+        {
+            variant.band[b].assign((size_t)variant.row_bytes * variant.y_scaling_factor * BAND_ROWS, 0);
+        }
+    }
     
-    for (int i = 0; i < num_rows; i++)
+    vector<int> red(num_cols), green(num_cols), blue(num_cols);
+    vector<double> average(num_cols);
+    auto total_start = chrono::steady_clock::now();
+    
+    // Note: BMP files store rows from bottom to top, so walk the source that way
+    int buffer = 0;
+    for (int band_end = num_rows; band_end > 0; band_end -= BAND_ROWS)
     {
-        for (int j = 0; j < num_cols; j++)
+        int band_start = max(0, band_end - BAND_ROWS);
+        
+        // the previous band is still being written from the other buffer
+        for (int i = band_end - 1; i >= band_start; i--)
         {
-            // get original pixel color values
-            int red_value = image[i][j].red;
-            int green_value = image[i][j].green;
-            int blue_value = image[i][j].blue;
-            
-            //find average of R,G,B values
-            double average_value = (red_value + green_value + blue_value)/3.0;
+            // load the source row once for every variant
+            for (int j = 0; j < num_cols; j++)
+            {
+                red[j] = image[i][j].red;
+                green[j] = image[i][j].green;
+                blue[j] = image[i][j].blue;
+                average[j] = (red[j] + green[j] + blue[j]) / 3.0;
+            }
             
-            // If cell is light, make it lighter
-            if (average_value >= 170)
+            for (Sweep_Variant& variant : variants)
             {
-                new_image[i][j].red = 255 - (255 - red_value)*scaling_factor;
-                new_image[i][j].green = 255 - (255 - green_value)*scaling_factor;
-                new_image[i][j].blue = 255 - (255 - blue_value)*scaling_factor;
+                auto start = chrono::steady_clock::now();
+                size_t row_in_band = band_end - 1 - i;
+                unsigned char* out = variant.band[buffer].data()
+                    + row_in_band * variant.y_scaling_factor * variant.row_bytes;
+                sweep_row(variant, red, green, blue, average, out);
+                variant.compute_ms += chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
             }
-            else if (average_value < 90)
+        }
+        
+        // wait for the previous band's writers (bands must reach the file
+        // in order, and that buffer is the one computed into next)
+        for (Sweep_Variant& variant : variants)
+        {
+            if (variant.writer.joinable()) { variant.writer.join(); }
+        }
+        
+        // hand the band to the writers and move on to the other buffer
+        for (Sweep_Variant& variant : variants)
+        {
+            size_t band_bytes = (size_t)(band_end - band_start) * variant.y_scaling_factor * variant.row_bytes;
+            const unsigned char* data = variant.band[buffer].data();
+            variant.writer = thread([&variant, data, band_bytes]()
             {
-                new_image[i][j].red = red_value*scaling_factor;
-                new_image[i][j].green = green_value*scaling_factor;
-                new_image[i][j].blue = blue_value*scaling_factor;
+                auto start = chrono::steady_clock::now();
+                variant.stream.write((const char*)data, band_bytes);
+                variant.write_ms += chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+            });
+        }
+        buffer = 1 - buffer;
+    }
+    
+    int num_written = 0;
+    for (Sweep_Variant& variant : variants)
+    {
+        if (variant.writer.joinable()) { variant.writer.join(); }
+        variant.stream.close();
+        variant.written = !variant.stream.fail();
+        if (variant.written) { num_written++; }
+    }
+    double total_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - total_start).count();
+    
+    // report throughput
+    double total_pixels = 0;
+    cout << endl;
+    for (const Sweep_Variant& variant : variants)
+    {
+        double pixels = (double)num_rows * variant.y_scaling_factor * num_cols * variant.x_scaling_factor;
+        total_pixels += pixels;
+        if (!variant.written)
+        {
+            cout << "  " << variant.output_file << "\tCOULD NOT BE WRITTEN" << endl;
+            continue;
+        }
+        cout << "  " << variant.output_file << "\tcompute " << variant.compute_ms << " ms, write "
+             << variant.write_ms << " ms, " << pixels / ((variant.compute_ms + variant.write_ms) * 1000.0)
+             << " MPix/s" << endl;
+    }
+    if (num_written < (int)variants.size())
+    {
+        cout << "\nRendered " << variants.size() << " variants, only " << num_written << " written successfully." << endl;
+        return;
+    }
+    cout << "\nSuccessfully rendered " << variants.size() << " variants in " << total_ms << " ms ("
+         << total_pixels / (total_ms * 1000.0) << " MPix/s output)" << endl;
+}
+
+/** Process 15 - Chain of rotate, flip, crop and enlarge
+ * Steps are combined into one view and the image is written once at the
+ * end, so no intermediate image is ever built.
+ * @param - input image
+ * @param - input file name
+ * @return - view of the transformed image
+*/
+
+Image_View transform_image(const vector<vector<Pixel>>& image, string i_file)
+{
+    cout << "\nTransform selected\n" << endl;
+    Image_View view = make_view(image);
+    if (image.empty())
+    {
+        cout << "Current image could not be read. Choose another image." << endl;
+        return view;
+    }
+    
+    string step;
+    while (step != "w" && step != "W")
+    {
+        cout << "\n(Current size: " << view.num_cols() << "x" << view.num_rows() << ", "
+             << view.stages.size() << " stages)" << endl;
+        cout << "R) Rotate 90  F) Flip  C) Crop  E) Enlarge  W) Write: ";
+        cin >> step;
+        if (step == "r" || step == "R")
+        {
+            int num_rotations = 0;
+            cout << "How many times would you like to rotate this image? ";
+            cin >> num_rotations;
+            view = view_rotate(view, num_rotations);
+        }
+        else if (step == "f" || step == "F")
+        {
+            view = view_flip(view);
+        }
+        else if (step == "c" || step == "C")
+        {
+            int x, y, width, height;
+            cout << "Enter left column and top row of the crop: " << endl;
+            cin >> x >> y;
+            cout << "Enter width and height of the crop: " << endl;
+            cin >> width >> height;
+            if (x < 0 || y < 0 || width < 1 || height < 1
+                || x + width > view.num_cols() || y + height > view.num_rows())
+            {
+                cout << "\nCrop must be inside the image." << endl;
             }
-            else 
+            else { view = view_crop(view, y, x, height, width); }
+        }
+        else if (step == "e" || step == "E")
+        {
+            int x_scaling_factor, y_scaling_factor;
+            cout << "Enter integer to enlarge in X direction: " << endl;
+            cin >> x_scaling_factor;
+            cout << "Enter integer to englarge in Y direction: " << endl;
+            cin >> y_scaling_factor;
+            if (x_scaling_factor < 1 || y_scaling_factor < 1)
             {
-                new_image[i][j].red = red_value;
-                new_image[i][j].green = green_value;
-                new_image[i][j].blue = blue_value;
+                cout << "\nScaling factors must be at least 1." << endl;
             }
-
+            else if (!enlarge_fits(view, x_scaling_factor, y_scaling_factor))
+            {
+                cout << "\nEnlarged image would be too large." << endl;
+            }
+            else { view = view_enlarge(view, x_scaling_factor, y_scaling_factor); }
+        }
+        else if (step != "w" && step != "W")
+        {
+            cout << step + " is not a valid step." << endl;
         }
     }
     
-    // output new_img object as user-provided filename
-    write_image(output_file, new_image); 
-    cout << "\nSuccessfully added clarendon effect!" << endl;
+    string output_file = validate_file_name(i_file);
+    if (!write_view(output_file, view))
+    {
+        cout << "\nCould not write " << output_file << " (a BMP file is limited to 4 GB)." << endl;
+        return view;
+    }
+    cout << "\nSuccessfully transformed image!" << endl;
     
-    return new_image;
+    return view;
 }
 
- // 
+//
+// BATCH RUNNER
+//
+// Runs a list of jobs in N forked worker processes, so a file that crashes
+// a filter only takes down one worker. Jobs sit in shared memory; workers
+// claim the next one with a single atomic fetch_add (no locks), and record
+// which job they are on so the supervisor can quarantine the input if the
+// worker dies, then start a replacement. A worker killed between the claim
+// and recording it leaves its job pending; such jobs are reported as not
+// run rather than quarantined, since the input is not to blame.
+//
+
+const int MAX_PATH_LENGTH = 512;
+const int MAX_BATCH_WORKERS = 256;
+const int LATENCY_BUCKETS = 40;    // bucket b counts jobs taking [2^b, 2^(b+1)) microseconds
+
+static_assert(atomic<int>::is_always_lock_free, "shared memory queue needs lock-free atomics");
+static_assert(atomic<long long>::is_always_lock_free, "shared memory counters need lock-free atomics");
+
+// JOB_UNREADABLE inputs could not be opened at all (missing, no permission) and are
+// reported but left alone; JOB_INVALID and JOB_CRASHED inputs are quarantined
+enum Job_State { JOB_PENDING, JOB_DONE, JOB_INVALID, JOB_FAILED, JOB_CRASHED, JOB_UNREADABLE, JOB_NOT_RUN };
 
 /**
-  * Process 3 - Gray scale
-  * @param - input file name
-  * @param - output file name
-  * @return - output file image, vector of Pixels
-*/
+ * One job: read input, run an operation, write output
+ */
+struct Batch_Job
+{
+    char input_file[MAX_PATH_LENGTH];
+    char output_file[MAX_PATH_LENGTH];
+    Operation_Params params;
+    atomic<int> state;
+};
 
-vector<vector<Pixel>> gray_scale(const vector<vector<Pixel>>& image, string i_file)
+/**
+ * Per-worker state, kept across restarts of that worker
+ */
+struct Worker_Slot
 {
-    cout << "\nGray scale effect selected\n" << endl;
-    string output_file = validate_file_name(i_file); 
-    
-    // get height and width of original image
-    int num_rows = image.size(); 
-    int num_cols = image[0].size(); 
+    pid_t pid;
+    int restarts;
+    atomic<int> current_job;    // -1 when not working on a job
+    atomic<long long> jobs_done;
+    atomic<long long> pixels;
+    atomic<long long> latency[LATENCY_BUCKETS];
+};
+
+/**
+ * Shared memory layout: this header, then num_jobs Batch_Jobs
+ */
+struct Batch_Queue
+{
+    atomic<int> next_job;
+    int num_jobs;
+    int num_workers;
+    Worker_Slot slots[MAX_BATCH_WORKERS];
     
-    // initialize var to store new img
-    vector<vector<Pixel>> new_image(num_rows, vector<Pixel>(num_cols)); 
+    Batch_Job* jobs() { return (Batch_Job*)(this + 1); }
+};
+
+/** Helper function - parse one line of a job list
+ * Format: input.bmp operation output.bmp [parameters]
+ *   2, 8, 9  - scaling factor
+ *   5        - number of rotations
+ *   6        - x and y scaling factors
+ *   7        - threshold mode, then dither mode (global) or window radius
+ *   10       - dither mode
+ *   16       - blur radius
+ * @param - line of text
+ * @param - job to fill in
+ * @return - True if the line is a valid job
+*/
+
+bool parse_batch_job(string line, Batch_Job& job)
+{
+    istringstream fields(line);
+    string input_file, output_file;
+    Operation_Params params;
+    if (!(fields >> input_file >> params.menu_number >> output_file)) { return false; }
+    if (input_file.length() >= MAX_PATH_LENGTH || output_file.length() >= MAX_PATH_LENGTH) { return false; }
+    if (input_file == output_file) { return false; }
     
-    for (int i = 0; i < num_rows; i++)
+    int number = 0;
+    switch (params.menu_number)
     {
-        for (int j = 0; j < num_cols; j++)
-        {
-            // get original pixel color values
-            int red_value = image[i][j].red;
-            int green_value = image[i][j].green;
-            int blue_value = image[i][j].blue;
-            
-            //find average of R,G,B values
-            double average_value = (red_value + green_value + blue_value)/3.0;
-            
-            // set RGB values to average
-            new_image[i][j].red = average_value;
-            new_image[i][j].green = average_value;
-            new_image[i][j].blue = average_value;
-        }
+        case 1: case 3: break;
+        case 2: case 8: case 9: if (!(fields >> params.scaling_factor)) { return false; } break;
+        case 4: params.num_rotations = 1; break;
+        case 5: if (!(fields >> params.num_rotations)) { return false; } break;
+        case 6:
+            if (!(fields >> params.x_scaling_factor >> params.y_scaling_factor)) { return false; }
+            if (params.x_scaling_factor < 1 || params.y_scaling_factor < 1) { return false; }
+            break;
+        case 7:
+            if (!(fields >> number) || number < GLOBAL_THRESHOLD || number > SAUVOLA_THRESHOLD) { return false; }
+            params.threshold_mode = (Threshold_Mode)number;
+            if (params.threshold_mode == GLOBAL_THRESHOLD)
+            {
+                if (fields >> number)
+                {
+                    if (number < NO_DITHER || number > ORDERED_DITHER) { return false; }
+                    params.dither_mode = (Dither_Mode)number;
+                }
+            }
+            else if (!(fields >> params.radius) || params.radius < 1) { return false; }
+            break;
+        case 10:
+            if (fields >> number)
+            {
+                if (number < NO_DITHER || number > ORDERED_DITHER) { return false; }
+                params.dither_mode = (Dither_Mode)number;
+            }
+            break;
+        case 16: if (!(fields >> params.radius) || params.radius < 0) { return false; } break;
+        default: return false;
     }
     
-    // output new_img object as user-provided filename
-    write_image(output_file, new_image); 
-    cout << "\nSuccessfully added gray scale effect!" << endl;
-    
-    return new_image;
-
+    strcpy(job.input_file, input_file.c_str());
+    strcpy(job.output_file, output_file.c_str());
+    job.params = params;
+    return true;
 }
 
- 
-/**  Process 4 - Rotates by 90 degrees
- * @param - input file name
- * @param - output file name
- * @return - output image file
+/** Helper function - body of a worker process
+ * Claims jobs until the queue is empty, then exits.
+ * @param - shared queue
+ * @param - this worker's slot number
 */
 
-vector<vector<Pixel>> rotate_90(const vector<vector<Pixel>>& image, string o_file)
-{       
-    // get height and width of original image
-    int num_rows = image.size(); 
-    int num_cols = image[0].size(); 
-    
-    // initialize var to store new img; cols & rows swapped!
-    vector<vector<Pixel>> new_image(num_cols, vector<Pixel>(num_rows)); 
+void run_batch_worker(Batch_Queue* queue, int slot_number)
+{
+    Worker_Slot& slot = queue->slots[slot_number];
+    Batch_Job* jobs = queue->jobs();
     
-    for (int i = 0; i < num_cols; i++)
+    while (true)
     {
-        for (int j = 0; j < num_rows; j++)
-        {   
-            // rotate image 90 degrees
-            new_image[i][j] = image[(num_rows - 1) - j][i];
+        int k = queue->next_job.fetch_add(1);
+        if (k >= queue->num_jobs) { break; }
+        slot.current_job.store(k);
+        
+        Batch_Job& job = jobs[k];
+        auto start = chrono::steady_clock::now();
+        Loaded_Image loaded;
+        bool valid = load_image(job.input_file, loaded, 1);
+        if (!valid && !ifstream(job.input_file, ios::binary).is_open())
+        {
+            job.state.store(JOB_UNREADABLE);
+        }
+        else if (!valid)
+        {
+            job.state.store(JOB_INVALID);
         }
+        else
+        {
+            // workers already run one per CPU, so each job stays on one thread
+            bool written = write_operation_loaded(job.output_file, loaded, job.params, 1);
+            job.state.store(written ? JOB_DONE : JOB_FAILED);
+            if (written) { slot.pixels += (long long)loaded.height * loaded.width; }
+        }
+        long long microseconds = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - start).count();
+        
+        int bucket = 0;
+        while (bucket < LATENCY_BUCKETS - 1 && (2ll << bucket) <= microseconds) { bucket++; }
+        slot.latency[bucket]++;
+        slot.jobs_done++;
+        slot.current_job.store(-1);
     }
-    
-    // output new_img object as user-provided filename
-    write_image(o_file, new_image); 
-    
-    return new_image;
-
 }
 
-/** Process 5 - Rotates by multiples of 90 degrees
-  * @param - input file name
-  * @param - number of times to rotate
-  * @param - output file name
-  * @return - new image vector<vector<Pixel>>
+/** Helper function - move a file, copying it when rename cannot (e.g.
+ * the destination is on another file system)
+ * @param - current path
+ * @param - new path
+ * @param - reason for failure (output)
+ * @return - True if the file was moved
 */
 
-vector<vector<Pixel>> rotate_90_multiple(const vector<vector<Pixel>>& image, string o_file)
+bool move_file(string from, string to, string& error)
 {
-    //prompt user for number of times to rotate
-    int num_rotations = 0;
-    cout << "How many times would you like to rotate this image? ";
-    cin >> num_rotations; 
-    int angle = num_rotations*90;
-    
-    // initialize var to store new img
-    vector<vector<Pixel>> new_image; 
-    
-    // based on above, conditions to choose how many times to use rotate func
-    if ( angle % 90 != 0 ) { cout << "Angle must be a multiple of 90 degrees." << endl; }
-    else if ( angle % 360 == 0 ) { new_image = image; }
-    else if ( angle % 360 == 90 ) { new_image = rotate_90(image, o_file); }
-    else if ( angle % 360 == 180 ) { new_image = rotate_90(rotate_90(image, o_file), o_file); }
-    else { new_image = rotate_90(rotate_90(rotate_90(image, o_file), o_file), o_file); }
-
-    // output new_img object as user-provided filename
-    write_image(o_file, new_image); 
-    cout << "\nSuccessfully rotated image " <<  num_rotations << " times!" << endl;
+    if (rename(from.c_str(), to.c_str()) == 0) { return true; }
+    if (errno != EXDEV)
+    {
+        error = strerror(errno);
+        return false;
+    }
     
-    return new_image;
+    ifstream source(from, ios::binary);
+    ofstream destination(to, ios::binary);
+    if (!source.is_open() || !destination.is_open())
+    {
+        error = "could not copy across file systems";
+        return false;
+    }
+    destination << source.rdbuf();
+    destination.close();
+    if (!destination)
+    {
+        remove(to.c_str());
+        error = "could not copy across file systems";
+        return false;
+    }
+    if (remove(from.c_str()) != 0)
+    {
+        error = string("copied, but could not remove original: ") + strerror(errno);
+        return false;
+    }
+    return true;
 }
 
- /** Process 6 - Enlarges in the X and Y directions
-  * @param - input file name
-  * @param - x scaling factor
-  * @param - y scaling factor
-  * @param - output file name
-  * @return - new image
+/** Helper function - fork a worker into a slot
+ * @param - shared queue
+ * @param - slot number
+ * @return - True if the worker was started
 */
 
-vector<vector<Pixel>> enlarge(const vector<vector<Pixel>>& image, string i_file)
+bool start_batch_worker(Batch_Queue* queue, int slot_number)
 {
-    cout << "\nEnlarge image selected\n" << endl;
-    string output_file = validate_file_name(i_file); 
+    // don't let the child inherit (and repeat) buffered output
+    cout.flush();
+    pid_t pid = fork();
+    if (pid < 0) { return false; }
+    if (pid == 0)
+    {
+        run_batch_worker(queue, slot_number);
+        _exit(0);
+    }
+    queue->slots[slot_number].pid = pid;
+    return true;
+}
 
-    // get height and width of original image
-    int num_rows = image.size(); 
-    int num_cols = image[0].size(); 
+/** Helper function - latency (upper bound of its bucket) at a percentile
+ * @param - combined histogram
+ * @param - total number of jobs
+ * @param - percentile, 0-100
+ * @return - microseconds
+*/
 
-    // Prompt user for scaling factors
-    int x_scaling_factor; 
-    int y_scaling_factor;
-    cout << "Enter integer to enlarge in X direction: " << endl;
-    cin >> x_scaling_factor; 
-    cout << "Enter integer to englarge in Y direction: " << endl;
-    cin >> y_scaling_factor; 
-    
-    // initialize var to store new img
-    vector<vector<Pixel>> new_image(num_rows*y_scaling_factor, vector<Pixel>(num_cols*x_scaling_factor)); 
-    
-    for (int i = 0; i < num_rows*y_scaling_factor; i++)
+long long latency_percentile(const vector<long long>& histogram, long long total, double percentile)
+{
+    long long seen = 0;
+    for (int b = 0; b < LATENCY_BUCKETS; b++)
     {
-        for (int j = 0; j < num_cols*x_scaling_factor; j++)
-        {   
-            // write_new image
-            new_image[i][j] = image[i/y_scaling_factor][j/x_scaling_factor];
-        }
+        seen += histogram[b];
+        if (seen >= total * percentile / 100.0) { return 2ll << b; }
     }
-    
-    // output new_img object as user-provided filename
-    write_image(output_file, new_image); 
-    cout << "\nSuccessfully enlarged image!" << endl;
-    
-    return new_image;
+    return 2ll << (LATENCY_BUCKETS - 1);
 }
 
-/** Process 7 - Convert to high-contrast, B & W only
-  * @param - input file name
-  * @param - output file name
-  * @return new image w/ high-contrast applied
+/** Process 17 - Batch runner
+ * Reads a job list, forks worker processes that pull jobs from a shared
+ * memory queue, restarts any worker that crashes, moves inputs that
+ * crashed a worker or could not be read into a quarantine folder, and
+ * reports throughput and a latency histogram across all workers.
 */
 
-vector<vector<Pixel>> high_contrast(const vector<vector<Pixel>>& image, string i_file)
+void batch_runner()
 {
-    cout << "\nHigh Contrast selected\n" << endl;
-    string output_file = validate_file_name(i_file); 
+    cout << "\nBatch runner selected\n" << endl;
     
-    // Get size of original image
-    int num_rows = image.size(); 
-    int num_cols = image[0].size(); 
-
-    // initialize new image object
-    vector<vector<Pixel>> new_image(num_rows, vector<Pixel>(num_cols)); 
-
-
-    for (int i = 0; i < num_rows; i++)
+    string job_list;
+    cout << "Enter job list file name: ";
+    cin >> job_list;
+    
+    int num_workers = 0;
+    cout << "Enter number of worker processes (0 for one per core): ";
+    cin >> num_workers;
+    if (num_workers <= 0) { num_workers = max(1u, thread::hardware_concurrency()); }
+    num_workers = min(num_workers, MAX_BATCH_WORKERS);
+    
+    string quarantine_dir;
+    cout << "Enter quarantine folder: ";
+    cin >> quarantine_dir;
+    
+    // read the job list
+    ifstream list(job_list);
+    if (!list.is_open())
     {
-        for (int j = 0; j < num_cols; j++)
+        cout << "\nCould not open " << job_list << endl;
+        return;
+    }
+    vector<string> lines;
+    string line;
+    while (getline(list, line))
+    {
+        if (line.find_first_not_of(" \t\r") == string::npos || line[line.find_first_not_of(" \t")] == '#') { continue; }
+        lines.push_back(line);
+    }
+    
+    // shared memory for the queue, visible to every forked worker
+    size_t bytes = sizeof(Batch_Queue) + lines.size() * sizeof(Batch_Job);
+    void* memory = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED)
+    {
+        cout << "\nCould not allocate shared memory for " << lines.size() << " jobs." << endl;
+        return;
+    }
+    Batch_Queue* queue = new (memory) Batch_Queue();
+    Batch_Job* jobs = queue->jobs();
+    
+    int num_jobs = 0;
+    for (size_t k = 0; k < lines.size(); k++)
+    {
+        Batch_Job* job = new (&jobs[num_jobs]) Batch_Job();
+        if (parse_batch_job(lines[k], *job))
         {
-            // get original pixel color values
-            int red_value = image[i][j].red;
-            int green_value = image[i][j].green;
-            int blue_value = image[i][j].blue;
-            
-            // average to find gray values
-            double gray_value = (red_value + green_value + blue_value) / 3.0;
-            
-            // set pixel values for new image
-            if (gray_value >= 255/2.0)
-            {
-                new_image[i][j].red = 255;
-                new_image[i][j].green = 255;
-                new_image[i][j].blue = 255; 
-            }
-            else 
-            {
-                new_image[i][j].red = 0; 
-                new_image[i][j].green = 0; 
-                new_image[i][j].blue = 0;
-            }
+            job->state.store(JOB_PENDING);
+            num_jobs++;
         }
+        else { cout << "Skipping bad job line: " << lines[k] << endl; }
     }
-    write_image(output_file, new_image);
-    cout << "\nSuccessfully added high-contrast filter!" << endl;
-
-    return new_image;
-}
-
- /** Process 8 - Lighten image
-  * @param - input file name
-  * @param - output file name
-  * @return - output image
-  */
-vector<vector<Pixel>> lighten_image(const vector<vector<Pixel>>& image, string i_file)
-{
-    cout << "\nLighten Image selected\n" << endl;
-    string output_file = validate_file_name(i_file); 
+    queue->num_jobs = num_jobs;
+    queue->num_workers = num_workers;
+    queue->next_job.store(0);
+    for (int w = 0; w < num_workers; w++) { queue->slots[w].current_job.store(-1); }
     
-    // get scaling factor
-    cout << "Enter a scaling factor: ";
-    double scaling_factor;
-    cin >> scaling_factor; 
+    cout << "\nRunning " << num_jobs << " jobs on " << num_workers << " workers..." << endl;
+    auto start = chrono::steady_clock::now();
     
-    // Get size of original image
-    int num_rows = image.size(); 
-    int num_cols = image[0].size(); 
-
-    // initialize new image object
-    vector<vector<Pixel>> new_image(num_rows, vector<Pixel>(num_cols)); 
-
-
-    for (int i = 0; i < num_rows; i++)
+    int running = 0;
+    for (int w = 0; w < num_workers; w++)
     {
-        for (int j = 0; j < num_cols; j++)
+        if (start_batch_worker(queue, w)) { running++; }
+    }
+    
+    // supervise: replace workers that die while jobs remain
+    while (running > 0)
+    {
+        int status = 0;
+        pid_t pid = waitpid(-1, &status, 0);
+        if (pid < 0)
         {
-            // get original pixel color values
-            int red_value = image[i][j].red;
-            int green_value = image[i][j].green;
-            int blue_value = image[i][j].blue;
-            
-            // lighten image to scaling factor
-            new_image[i][j].red = (255 - (255 - red_value) * scaling_factor);
-            new_image[i][j].green = (255 - (255 - green_value) * scaling_factor);
-            new_image[i][j].blue = (255 - (255 - blue_value) * scaling_factor); 
+            if (errno == EINTR) { continue; }
+            break;
+        }
+        
+        int w = 0;
+        while (w < num_workers && queue->slots[w].pid != pid) { w++; }
+        if (w == num_workers) { continue; }
+        running--;
+        
+        if (WIFEXITED(status) && WEXITSTATUS(status) == 0) { continue; }
+        
+        int k = queue->slots[w].current_job.exchange(-1);
+        if (k >= 0)
+        {
+            jobs[k].state.store(JOB_CRASHED);
+            remove(jobs[k].output_file);    // partial output, if any
+            cout << "Worker " << w << " crashed on " << jobs[k].input_file << endl;
+        }
+        if (queue->next_job.load() < num_jobs && start_batch_worker(queue, w))
+        {
+            queue->slots[w].restarts++;
+            running++;
         }
     }
-    write_image(output_file, new_image);
-    cout << "\nSuccessfully lightened image!" << endl;
-
-    return new_image;
-}
-
-
-
- /** Process 9 - Darken image
-  * @param - input file name
-  * @param - output file name
-  * @return - new image
-  */
+    double total_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
     
-vector<vector<Pixel>> darken_image(const vector<vector<Pixel>>& image, string i_file)
-{
-    // prompt for output file name
-    cout << "\nDarken Image selected\n" << endl;
-    string output_file = validate_file_name(i_file);
+    // jobs still pending were claimed by a worker that died before recording
+    // them, or never started because no worker could be forked
+    for (int k = 0; k < num_jobs; k++)
+    {
+        int pending = JOB_PENDING;
+        if (jobs[k].state.compare_exchange_strong(pending, JOB_NOT_RUN))
+        {
+            cout << "Job not run: " << jobs[k].input_file << endl;
+        }
+    }
     
-    // get scaling factor
-    cout << "Enter a scaling factor: ";
-    double scaling_factor;
-    cin >> scaling_factor; 
+    // quarantine inputs that crashed a worker or are not valid BMPs
+    int counts[JOB_NOT_RUN + 1] = {0};
+    int not_moved = 0;
+    bool have_folder = mkdir(quarantine_dir.c_str(), 0755) == 0 || errno == EEXIST;
+    if (!have_folder)
+    {
+        cout << "Could not create quarantine folder " << quarantine_dir << ": " << strerror(errno) << endl;
+    }
+    ofstream quarantine_log;
+    if (have_folder) { quarantine_log.open(quarantine_dir + "/quarantine.txt", ios::app); }
+    for (int k = 0; k < num_jobs; k++)
+    {
+        int state = jobs[k].state.load();
+        counts[state]++;
+        if (state == JOB_UNREADABLE) { cout << "Could not open " << jobs[k].input_file << endl; }
+        if (state == JOB_CRASHED || state == JOB_INVALID)
+        {
+            string input_file = jobs[k].input_file;
+            string file_name = input_file.substr(input_file.find_last_of('/') + 1);
+            string reason = state == JOB_CRASHED ? "crashed worker" : "not a valid BMP";
+            string error = "no quarantine folder";
+            if (!have_folder || !move_file(input_file, quarantine_dir + "/" + file_name, error))
+            {
+                not_moved++;
+                reason += " (left in place: " + error + ")";
+                cout << "Could not quarantine " << input_file << ": " << error << endl;
+            }
+            if (quarantine_log.is_open()) { quarantine_log << input_file << "\t" << reason << endl; }
+        }
+    }
     
-    // Get size of original image
-    int num_rows = image.size(); 
-    int num_cols = image[0].size(); 
-
-    // initialize new image object
-    vector<vector<Pixel>> new_image(num_rows, vector<Pixel>(num_cols)); 
-
-
-    for (int i = 0; i < num_rows; i++)
+    // combine the workers' counters
+    vector<long long> histogram(LATENCY_BUCKETS, 0);
+    long long finished = 0, pixels = 0;
+    int restarts = 0;
+    for (int w = 0; w < num_workers; w++)
     {
-        for (int j = 0; j < num_cols; j++)
+        const Worker_Slot& slot = queue->slots[w];
+        for (int b = 0; b < LATENCY_BUCKETS; b++) { histogram[b] += slot.latency[b].load(); }
+        finished += slot.jobs_done.load();
+        pixels += slot.pixels.load();
+        restarts += slot.restarts;
+    }
+    
+    cout << "\nDone: " << counts[JOB_DONE] << "  invalid: " << counts[JOB_INVALID]
+         << "  write failed: " << counts[JOB_FAILED] << "  crashed: " << counts[JOB_CRASHED]
+         << "  could not open: " << counts[JOB_UNREADABLE] << "  not run: " << counts[JOB_NOT_RUN] << "  (worker restarts: " << restarts << ")" << endl;
+    cout << "Total " << total_ms << " ms, " << num_jobs / (total_ms / 1000.0) << " jobs/s, "
+         << pixels / (total_ms * 1000.0) << " MPix/s" << endl;
+    if (finished > 0)
+    {
+        cout << "Latency p50 < " << latency_percentile(histogram, finished, 50) << " us, p90 < "
+             << latency_percentile(histogram, finished, 90) << " us, p99 < "
+             << latency_percentile(histogram, finished, 99) << " us" << endl;
+        cout << "\nLatency histogram (microseconds):" << endl;
+        for (int b = 0; b < LATENCY_BUCKETS; b++)
         {
-            // get original pixel color values
-            int red_value = image[i][j].red;
-            int green_value = image[i][j].green;
-            int blue_value = image[i][j].blue;
-            
-            // set new pixel to scaling factor
-            new_image[i][j].red = red_value * scaling_factor;
-            new_image[i][j].green = green_value * scaling_factor;
-            new_image[i][j].blue = blue_value * scaling_factor; 
+            if (histogram[b] == 0) { continue; }
+            cout << "  " << (b == 0 ? 0 : 1ll << b) << " - " << (2ll << b) << "\t" << histogram[b] << endl;
         }
     }
-    write_image(output_file, new_image);
-    cout << "\nSuccessfully darkened image!" << endl;
-
-    return new_image;
+    if (counts[JOB_CRASHED] + counts[JOB_INVALID] > 0 && quarantine_log.is_open())
+    {
+        cout << "\nQuarantined inputs are listed in " << quarantine_dir << "/quarantine.txt";
+        if (not_moved > 0) { cout << " (" << not_moved << " could not be moved)"; }
+        cout << endl;
+    }
+    else if (counts[JOB_CRASHED] + counts[JOB_INVALID] > 0)
+    {
+        cout << "\nCould not write " << quarantine_dir << "/quarantine.txt" << endl;
+    }
+    
+    munmap(memory, bytes);
 }
 
-/** Process 10 - Convert to only blk, wht, rd, blue, grn
- * @param - input file name
- * @param - output file name
- * @return - output image
- */ 
-vector<vector<Pixel>> bwrgb(const vector<vector<Pixel>>& image, string i_file)
-{
-    cout << "\nB/W/R/G/B selected\n" << endl;
-    string output_file = validate_file_name(i_file);
-    
-    // Get size of original image
-    int num_rows = image.size(); 
-    int num_cols = image[0].size(); 
+/** Helper function - whether a menu selection works on the loaded image
+ * @param - menu selection
+ * @return - True if the selection needs the loaded image
+*/
 
-    // initialize new image object
-    vector<vector<Pixel>> new_image(num_rows, vector<Pixel>(num_cols)); 
+bool needs_image(string menu_selection)
+{
+    for (string selection : {"1", "2", "3", "4", "5", "6", "7", "8", "9", "10", "15", "16"})
+    {
+        if (menu_selection == selection) { return true; }
+    }
+    return false;
+}
 
+/** Helper function - whether a menu option runs in the loaded image's format
+ * @param - menu selection
+ * @return - True for the operations write_operation_as handles
+*/
 
-    for (int i = 0; i < num_rows; i++)
+bool needs_format(string menu_selection)
+{
+    for (string selection : {"1", "2", "3", "4", "5", "6", "7", "8", "9", "10", "16"})
     {
-        for (int j = 0; j < num_cols; j++)
-        {
-            // get original pixel color values
-            int red_value = image[i][j].red;
-            int green_value = image[i][j].green;
-            int blue_value = image[i][j].blue;
-            
-            // figure out which color has highest value
-            int max_color = red_value;
-            if (green_value > max_color)
-            {
-               max_color = green_value;
-            }
-            if (blue_value > max_color)
-            {
-               max_color = blue_value;  
-            }
-            
-            // set new pixel values
-            if (red_value + green_value + blue_value >= 550)
-            {   
-                new_image[i][j].red = 255;
-                new_image[i][j].green = 255;
-                new_image[i][j].blue = 255;
-            }
-            else if (red_value + green_value + blue_value <= 150)
-            {   
-                new_image[i][j].red = 0;
-                new_image[i][j].green = 0;
-                new_image[i][j].blue = 0;
-            }
-            else if (max_color == red_value)
-            {
-                new_image[i][j].red = 255;
-                new_image[i][j].green = 0;
-                new_image[i][j].blue = 0;
-            }
-            else if (max_color == green_value)
-            {
-                new_image[i][j].red = 0;
-                new_image[i][j].green = 255;
-                new_image[i][j].blue = 0;
-            }
-            else
-            {
-                new_image[i][j].red = 0;
-                new_image[i][j].green = 0;
-                new_image[i][j].blue = 255;
-            }
-        }
+        if (menu_selection == selection) { return true; }
     }
-    write_image(output_file, new_image);
-    cout << "\nSuccessfully applied B/W/R/G/B to image!" << endl;
-
-    return new_image;
+    return false;
 }
 
 int main()
@@ -776,7 +4628,14 @@ int main()
     }
     
     // save new img file in global scope
-    vector<vector<Pixel>> input_img = read_image(input_file); 
+    // decoded with the kernels' thread count, so each band starts on its thread's node
+    int num_threads = max(1u, thread::hardware_concurrency());
+    Memory_Settings memory_settings;
+    Loaded_Image loaded_img;
+    if (!load_image(input_file, loaded_img, num_threads))
+    {
+        cout << "\nCould not read " << input_file << " as a BMP image." << endl;
+    }
     
     string menu = "\n-----------------------------------\n"
         "\nIMAGE PROCESSING MENU\n\n" 
@@ -791,6 +4650,14 @@ int main()
         "8) Lighten\n"
         "9) Darken\n"
         "10) Black, white, red, green, blue\n"
+        "11) Preview (fast, reduced resolution)\n"
+        "12) Benchmarks\n"
+        "13) Apply to a region only\n"
+        "14) Parameter sweep\n"
+        "15) Transform (rotate, flip, crop, enlarge)\n"
+        "16) Box blur\n"
+        "17) Batch runner\n"
+        "18) Memory settings (huge pages, NUMA)\n"
         "\n-----------------------------------\n"
         "\nEnter numeric menu selection (or Q to quit): \n";
 
@@ -827,33 +4694,41 @@ int main()
            }
            while (!valid);
            input_file = new_file_name; 
-           input_img = read_image(input_file);
+           if (!load_image(input_file, loaded_img, num_threads))
+           {
+               cout << "\nCould not read " << input_file << " as a BMP image." << endl;
+           }
+           else if (memory_settings.pages != SMALL_PAGES || memory_settings.numa != FIRST_TOUCH)
+           {
+               print_memory_report(apply_memory_settings(loaded_img, memory_settings), memory_settings);
+           }
         }
-        else if (menu_selection == "1") { add_vignette(input_img, input_file); }
-        else if (menu_selection == "2") { add_clarendon(input_img, input_file); }
-        else if (menu_selection == "3") { gray_scale(input_img, input_file); } 
-        else if (menu_selection == "4") 
-        { 
-            cout << "\nRotate 90 degrees selected\n" << endl;
-            string output_file;
-            output_file = validate_file_name(input_file); 
-            
-            rotate_90(input_img, output_file); 
-            cout << "\nSuccessfully rotated image!" << endl;
+        else if (loaded_img.bits_per_pixel == 0 && needs_image(menu_selection))
+        {
+            cout << "\nCurrent image could not be read. Choose another image." << endl;
         }
-        else if (menu_selection == "5") 
-        { 
-            cout << "\nRotate multiple of 90 degrees selected\n" << endl;
-            string output_file;
-            output_file = validate_file_name(input_file); 
-            
-            rotate_90_multiple(input_img, output_file); 
+        else if (needs_format(menu_selection))
+        {
+            process_loaded_image(stoi(menu_selection), loaded_img, input_file, num_threads);
+        }
+        else if (menu_selection == "11") { preview_operation(loaded_img, input_file, num_threads); }
+        else if (menu_selection == "12") { run_benchmarks(loaded_pixels(loaded_img), input_file); }
+        else if (menu_selection == "13") { process_region(input_file, num_threads); }
+        else if (menu_selection == "14") { parameter_sweep(loaded_pixels(loaded_img), input_file); }
+        else if (menu_selection == "15") { transform_image(loaded_pixels(loaded_img), input_file); }
+        else if (menu_selection == "17") { batch_runner(); }
+        else if (menu_selection == "18")
+        {
+            // reload so the rows are allocated again under the new policy
+            if (memory_settings_menu(memory_settings) && loaded_img.bits_per_pixel != 0)
+            {
+                if (!load_image(input_file, loaded_img, num_threads))
+                {
+                    cout << "\nCould not read " << input_file << " as a BMP image." << endl;
+                }
+                else { print_memory_report(apply_memory_settings(loaded_img, memory_settings), memory_settings); }
+            }
         }
-        else if (menu_selection == "6") { enlarge(input_img, input_file); }
-        else if (menu_selection == "7") { high_contrast(input_img, input_file); }
-        else if (menu_selection == "8") { lighten_image(input_img, input_file); }
-        else if (menu_selection == "9") { darken_image(input_img, input_file); }
-        else if (menu_selection == "10") { bwrgb(input_img, input_file); }
         else 
         {
             cout << menu_selection + " is not a valid menu option. " << endl;